@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "affinity.h"
+
+static int thread_id(void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+// core and NUMA node the calling thread is running on, -1 when unknown
+static void current_placement(int* cpu, int* node)
+{
+    *cpu = -1;
+    *node = -1;
+
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned int c, n;
+    if (syscall(SYS_getcpu, &c, &n, NULL) == 0) {
+        *cpu = c;
+        *node = n;
+    }
+#endif
+}
+
+#ifdef __linux__
+/*
+ * Splits the CPUs this process may run on evenly between the ranks of the
+ * node, in order, and pins each thread of this rank to one CPU of its share.
+ * mpirun usually leaves every rank the same mask when it does not bind, so
+ * the shares do not overlap.
+ */
+static int bind_threads(int threads, MPI_Comm comm)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return -1;
+    }
+
+    MPI_Comm node;
+    int local_rank, local_ranks;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &local_rank);
+    MPI_Comm_size(node, &local_ranks);
+    MPI_Comm_free(&node);
+
+    int cpus = CPU_COUNT(&allowed);
+    int* list = malloc(cpus * sizeof(int));
+    for (int cpu = 0, n = 0; cpu < CPU_SETSIZE && n < cpus; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            list[n++] = cpu;
+        }
+    }
+
+    int share = cpus / local_ranks > 0 ? cpus / local_ranks : 1;
+    int first = (local_rank * share) % cpus;
+    int failed = 0;
+
+#pragma omp parallel num_threads(threads) reduction(+ : failed)
+    {
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        CPU_SET(list[(first + thread_id() % share) % cpus], &mask);
+
+        // pid 0 is the calling thread
+        failed += sched_setaffinity(0, sizeof(mask), &mask) != 0;
+    }
+
+    free(list);
+    return failed > 0 ? -1 : 0;
+}
+#endif
+
+/*
+ * Collective: optionally binds every rank's render threads (root's bind flag
+ * is used), then gathers the core and NUMA node of every thread to root and
+ * prints them, so bad placement shows up before a long render.
+ */
+void place_threads(const Tuning* tuning, int bind, MPI_Comm comm)
+{
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+    MPI_Bcast(&bind, 1, MPI_INT, 0, comm);
+
+    int threads = tuning->threads > 0 ? tuning->threads : 1;
+
+    if (bind) {
+#ifdef __linux__
+        if (bind_threads(threads, comm) != 0) {
+            printf("Rank %d: could not bind render threads\n", rank);
+        }
+#else
+        if (rank == 0) {
+            printf("Thread binding is only supported on Linux\n");
+        }
+#endif
+    }
+
+    // every thread reports from where it runs, in the same team layout the render uses
+    int* placement = malloc(2 * threads * sizeof(int));
+#pragma omp parallel num_threads(threads)
+    {
+        int cpu, node;
+        current_placement(&cpu, &node);
+        placement[2 * thread_id()] = cpu;
+        placement[2 * thread_id() + 1] = node;
+    }
+
+    char host[MPI_MAX_PROCESSOR_NAME];
+    int host_length;
+    memset(host, 0, sizeof(host));
+    MPI_Get_processor_name(host, &host_length);
+
+    // hosts may be tuned to different thread counts
+    int* counts = NULL;
+    int* displs = NULL;
+    int* all = NULL;
+    char* hosts = NULL;
+    int length = 2 * threads;
+    if (rank == 0) {
+        counts = malloc(ranks * sizeof(int));
+        displs = malloc(ranks * sizeof(int));
+        hosts = malloc(MPI_MAX_PROCESSOR_NAME * ranks);
+    }
+
+    MPI_Gather(&length, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+    if (rank == 0) {
+        int total = 0;
+        for (int r = 0; r < ranks; r++) {
+            displs[r] = total;
+            total += counts[r];
+        }
+        all = malloc(total * sizeof(int));
+    }
+
+    MPI_Gatherv(placement, length, MPI_INT, all, counts, displs, MPI_INT, 0, comm);
+    MPI_Gather(host, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, hosts, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, 0, comm);
+
+    if (rank == 0) {
+        printf("Rank  thread  host                 cpu  node\n");
+        for (int r = 0; r < ranks; r++) {
+            for (int t = 0; t < counts[r] / 2; t++) {
+                printf("%4d  %6d  %-20s %4d  %4d\n", r, t, hosts + r * MPI_MAX_PROCESSOR_NAME,
+                    all[displs[r] + 2 * t], all[displs[r] + 2 * t + 1]);
+            }
+        }
+    }
+
+    free(placement);
+    free(counts);
+    free(displs);
+    free(all);
+    free(hosts);
+}
@@ -0,0 +1,10 @@
+#ifndef _AFFINITY_H_
+#define _AFFINITY_H_
+
+#include <mpi.h>
+
+#include "kernels.h"
+
+void place_threads(const Tuning* tuning, int bind, MPI_Comm comm);
+
+#endif
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "affinity.h"
+#include "atlas.h"
+#include "density.h"
+#include "image_io.h"
+#include "partition.h"
+#include "tune.h"
+
+int parse_atlas_grid(const char* text, Bound* grid)
+{
+    int columns, rows;
+    char extra;
+
+    if (text == NULL || sscanf(text, "%dx%d%c", &columns, &rows, &extra) != 2 || columns <= 0 || rows <= 0) {
+        return -1;
+    }
+
+    make_bound(grid, columns, rows);
+    return 0;
+}
+
+// The grid covers the Mandelbrot set's own view around center, so the atlas
+// is a map of the c plane; every Julia set is drawn over the default view.
+void make_atlas(Atlas* atlas, Bound grid, Bound image, Point center, uint32_t max_iterations, Colouring colouring, int files)
+{
+    Kernel mandelbrot;
+    Point origin = { 0.0, 0.0 };
+    RectSize size;
+
+    make_kernel(&mandelbrot, FRACTAL_MANDELBROT, 2, origin, max_iterations);
+    default_view(&mandelbrot, &origin, &size);
+    make_rect(&atlas->params, center, size);
+
+    make_kernel(&atlas->kernel, FRACTAL_JULIA, 2, origin, max_iterations);
+    default_view(&atlas->kernel, &origin, &size);
+    make_rect(&atlas->view, origin, size);
+
+    atlas->grid = grid;
+    atlas->image = image;
+    atlas->colouring = colouring;
+    atlas->files = files;
+}
+
+static Point atlas_c(const Atlas* atlas, uint32_t index)
+{
+    uint32_t column = index % atlas->grid.width;
+    uint32_t row = index / atlas->grid.width;
+    Point c = {
+        atlas->params.ul.x + rect_width(atlas->params) * (column + 0.5) / atlas->grid.width,
+        atlas->params.ul.y - rect_height(atlas->params) * (row + 0.5) / atlas->grid.height,
+    };
+
+    return c;
+}
+
+static void image_work(WorkUnit* work, const Atlas* atlas, uint32_t index)
+{
+    memset(work, 0, sizeof(*work));
+    work->kernel = atlas->kernel;
+    work->kernel.c = atlas_c(atlas, index);
+    work->colouring = atlas->colouring;
+    work->render = RENDER_ESCAPE;
+    work->precision = PRECISION_DOUBLE;
+    make_band(work, atlas->view, atlas->image, 0, atlas->image.height);
+}
+
+static void share_atlas(const Local_MPI_Types* types, Atlas* atlas, char* file_name, MPI_Comm comm)
+{
+    uint32_t flags[2] = { atlas->colouring, atlas->files };
+
+    MPI_Bcast(&atlas->grid, 1, types->bound_type, 0, comm);
+    MPI_Bcast(&atlas->image, 1, types->bound_type, 0, comm);
+    MPI_Bcast(&atlas->params, 1, types->rect_type, 0, comm);
+    MPI_Bcast(&atlas->view, 1, types->rect_type, 0, comm);
+    MPI_Bcast(&atlas->kernel, 1, types->kernel_type, 0, comm);
+    MPI_Bcast(flags, 2, MPI_UINT32_T, 0, comm);
+    MPI_Bcast(file_name, OUTPUT_NAME_MAX, MPI_CHAR, 0, comm);
+
+    atlas->colouring = flags[0];
+    atlas->files = flags[1];
+}
+
+// the coloured image, in a pool buffer that lasts until the next image
+static Pixel* render_image(const Atlas* atlas, uint32_t index, const Tuning* tuning, BufferPool* pool)
+{
+    WorkUnit work;
+    image_work(&work, atlas, index);
+
+    pool_reset(pool);
+    uint32_t* iterations = pool_get(pool, bound_length(atlas->image) * sizeof(uint32_t));
+    Pixel* pixels = pool_get(pool, bound_length(atlas->image) * sizeof(Pixel));
+
+    render_work(&work, iterations, tuning, NULL);
+    colour_band(&work, iterations, pixels, tuning, pool, MPI_COMM_SELF);
+
+    return pixels;
+}
+
+static int write_atlas_image(const Atlas* atlas, uint32_t index, const Pixel* pixels, const char* file_name)
+{
+    char name[OUTPUT_NAME_MAX];
+
+    frame_file_name(name, file_name, index, bound_length(atlas->grid));
+    return write_image(pixels, atlas->image, name, NULL, NULL);
+}
+
+typedef struct ImageCost {
+    double cost;
+    uint32_t index;
+} ImageCost;
+
+static int by_falling_cost(const void* a, const void* b)
+{
+    const ImageCost* x = a;
+    const ImageCost* y = b;
+
+    if (x->cost != y->cost) {
+        return x->cost < y->cost ? 1 : -1;
+    }
+
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// image indices in longest processing time first order, from a coarse pre-pass of each image
+static uint32_t* schedule_images(const Atlas* atlas, const Tuning* tuning)
+{
+    uint32_t count = bound_length(atlas->grid);
+    ImageCost* costs = malloc(count * sizeof(ImageCost));
+    Bound probe = { ATLAS_PROBE_SIZE, ATLAS_PROBE_SIZE };
+
+    for (uint32_t i = 0; i < count; i++) {
+        Kernel kernel = atlas->kernel;
+        kernel.c = atlas_c(atlas, i);
+
+        double* row_cost = estimate_row_costs(atlas->view, probe, &kernel, tuning);
+        costs[i].cost = 0.0;
+        costs[i].index = i;
+        for (int y = 0; y < ATLAS_PROBE_SIZE; y++) {
+            costs[i].cost += row_cost[y];
+        }
+        free(row_cost);
+    }
+
+    qsort(costs, count, sizeof(ImageCost), by_falling_cost);
+
+    uint32_t* order = malloc(count * sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++) {
+        order[i] = costs[i].index;
+    }
+
+    free(costs);
+    return order;
+}
+
+// upper left pixel of an image's cell in the mosaic
+static Pixel* mosaic_cell(Pixel* mosaic, const Atlas* atlas, uint32_t index)
+{
+    size_t mosaic_width = (size_t)atlas->grid.width * atlas->image.width;
+
+    return mosaic + (size_t)(index / atlas->grid.width) * atlas->image.height * mosaic_width
+        + (size_t)(index % atlas->grid.width) * atlas->image.width;
+}
+
+static void place_image(Pixel* mosaic, const Atlas* atlas, uint32_t index, const Pixel* pixels)
+{
+    size_t mosaic_width = (size_t)atlas->grid.width * atlas->image.width;
+    Pixel* cell = mosaic_cell(mosaic, atlas, index);
+
+    for (uint32_t y = 0; y < atlas->image.height; y++) {
+        memcpy(cell + y * mosaic_width, pixels + (size_t)y * atlas->image.width, atlas->image.width * sizeof(Pixel));
+    }
+}
+
+/*
+ * Root hands out images, most expensive first, one at a time to whichever
+ * rank returns a finished one, and receives mosaic images straight into
+ * their cells. In between, root renders the cheapest images left itself, so
+ * it never holds up the end of the run and is never away from the queue for
+ * long. Returns the number of images root rendered.
+ */
+static uint32_t dispatch_images(const Local_MPI_Types* types, const Atlas* atlas, const uint32_t* order, Pixel* mosaic,
+    const char* file_name, const Tuning* tuning, BufferPool* pool, int* status, MPI_Comm comm)
+{
+    int ranks;
+    MPI_Comm_size(comm, &ranks);
+
+    uint32_t head = 0, tail = bound_length(atlas->grid), rendered = 0;
+    int* assigned = malloc(ranks * sizeof(int));
+    int outstanding = 0;
+
+    MPI_Datatype cell_type;
+    MPI_Type_vector(atlas->image.height, atlas->image.width, atlas->grid.width * atlas->image.width, types->pixel_type, &cell_type);
+    MPI_Type_commit(&cell_type);
+
+    for (int r = 1; r < ranks; r++) {
+        assigned[r] = head < tail ? (int)order[head++] : -1;
+        MPI_Send(&assigned[r], 1, MPI_INT, r, ATLAS_TAG, comm);
+        outstanding += assigned[r] >= 0;
+    }
+
+    while (outstanding > 0 || head < tail) {
+        int pending = 0;
+        MPI_Status probed;
+
+        MPI_Iprobe(MPI_ANY_SOURCE, ATLAS_TAG, comm, &pending, &probed);
+        if (!pending && head < tail) {
+            uint32_t index = order[--tail];
+            Pixel* pixels = render_image(atlas, index, tuning, pool);
+
+            if (atlas->files) {
+                *status |= write_atlas_image(atlas, index, pixels, file_name);
+            } else {
+                place_image(mosaic, atlas, index, pixels);
+            }
+            rendered++;
+            continue;
+        }
+
+        if (!pending) {
+            MPI_Probe(MPI_ANY_SOURCE, ATLAS_TAG, comm, &probed);
+        }
+
+        int source = probed.MPI_SOURCE;
+        if (atlas->files) {
+            MPI_Recv(NULL, 0, types->pixel_type, source, ATLAS_TAG, comm, MPI_STATUS_IGNORE);
+        } else {
+            MPI_Recv(mosaic_cell(mosaic, atlas, assigned[source]), 1, cell_type, source, ATLAS_TAG, comm, MPI_STATUS_IGNORE);
+        }
+
+        assigned[source] = head < tail ? (int)order[head++] : -1;
+        MPI_Send(&assigned[source], 1, MPI_INT, source, ATLAS_TAG, comm);
+        outstanding -= assigned[source] < 0;
+    }
+
+    MPI_Type_free(&cell_type);
+    free(assigned);
+    return rendered;
+}
+
+static uint32_t serve_images(const Local_MPI_Types* types, const Atlas* atlas, const char* file_name, const Tuning* tuning, BufferPool* pool, int* status, MPI_Comm comm)
+{
+    uint32_t rendered = 0;
+    int index;
+
+    MPI_Recv(&index, 1, MPI_INT, 0, ATLAS_TAG, comm, MPI_STATUS_IGNORE);
+    while (index >= 0) {
+        Pixel* pixels = render_image(atlas, index, tuning, pool);
+
+        if (atlas->files) {
+            *status |= write_atlas_image(atlas, index, pixels, file_name);
+        }
+
+        // the result, or in file mode an empty message, asks for the next image
+        MPI_Send(pixels, atlas->files ? 0 : bound_length(atlas->image), types->pixel_type, 0, ATLAS_TAG, comm);
+        rendered++;
+
+        MPI_Recv(&index, 1, MPI_INT, 0, ATLAS_TAG, comm, MPI_STATUS_IGNORE);
+    }
+
+    return rendered;
+}
+
+/*
+ * Collective: renders every image of the atlas whole on a single rank. Each
+ * image is small, so splitting it into bands would only add messages; the
+ * ranks instead work through the images independently, handed out by root
+ * in order of estimated cost. The images are written one file each by the
+ * rank that rendered them, or returned to root and written as one mosaic.
+ */
+void run_atlas(const Local_MPI_Types* types, Atlas* atlas, char* file_name, const Tuning* requested, int autotune, int bind, BufferPool* pool, MPI_Comm comm)
+{
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    share_atlas(types, atlas, file_name, comm);
+
+    Tuning tuning;
+    WorkUnit sample;
+    Kernel kernel = atlas->kernel;
+    kernel.c = atlas_c(atlas, bound_length(atlas->grid) / 2);
+    make_calibration_work(&sample, atlas->view, atlas->image, &kernel);
+    establish_tuning(&tuning, &sample, requested, autotune, types->workunit_type, comm);
+    place_threads(&tuning, bind, comm);
+
+    WorkUnit work;
+    image_work(&work, atlas, 0);
+    pool_reset(pool);
+    pool_reserve(pool, pool_size(bound_length(atlas->image) * sizeof(uint32_t)) + pool_size(bound_length(atlas->image) * sizeof(Pixel)) + colour_buffer_size(&work));
+
+    int status = 0;
+    uint32_t rendered;
+    double start = MPI_Wtime();
+
+    if (rank == 0) {
+        uint32_t* order = schedule_images(atlas, &tuning);
+        printf("Atlas: %u x %u images of %u x %u, cost estimate took %.3fs\n", atlas->grid.width, atlas->grid.height,
+            atlas->image.width, atlas->image.height, MPI_Wtime() - start);
+
+        Pixel* mosaic = NULL;
+        if (!atlas->files) {
+            mosaic = malloc((size_t)bound_length(atlas->grid) * bound_length(atlas->image) * sizeof(Pixel));
+        }
+
+        rendered = dispatch_images(types, atlas, order, mosaic, file_name, &tuning, pool, &status, comm);
+        if (mosaic != NULL) {
+            Bound size = { atlas->grid.width * atlas->image.width, atlas->grid.height * atlas->image.height };
+            status |= write_image(mosaic, size, file_name, NULL, NULL);
+            free(mosaic);
+        }
+        free(order);
+    } else {
+        rendered = serve_images(types, atlas, file_name, &tuning, pool, &status, comm);
+    }
+
+    double elapsed = MPI_Wtime() - start;
+    uint32_t* counts = rank == 0 ? malloc(ranks * sizeof(uint32_t)) : NULL;
+    MPI_Gather(&rendered, 1, MPI_UINT32_T, counts, 1, MPI_UINT32_T, 0, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &status, 1, MPI_INT, MPI_BOR, comm);
+
+    if (rank == 0) {
+        for (int r = 0; r < ranks; r++) {
+            printf("Rank %d: %u images\n", r, counts[r]);
+        }
+        printf("Atlas of %u images took %.3fs, %.1f images/s%s\n", bound_length(atlas->grid), elapsed,
+            elapsed > 0.0 ? bound_length(atlas->grid) / elapsed : 0.0, status != 0 ? ", some images failed" : "");
+        free(counts);
+    }
+}
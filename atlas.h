@@ -0,0 +1,33 @@
+#ifndef _ATLAS_H_
+#define _ATLAS_H_
+
+#include <mpi.h>
+
+#include "colour.h"
+#include "kernels.h"
+#include "mpi_test.h"
+#include "pool.h"
+
+// Costs are estimated from the pre-pass of an image this size, which renders
+// it at PREPASS_FACTOR times lower resolution
+#define ATLAS_PROBE_SIZE 32
+
+#define ATLAS_TAG 3
+
+// A grid of Julia sets, one per c value. Image (column, row) is the Julia set
+// of the c at the center of cell (column, row) of params, drawn over view.
+typedef struct Atlas {
+    Bound grid;
+    Bound image;
+    Rect params;
+    Rect view;
+    Kernel kernel; // c is replaced for every image
+    uint32_t colouring;
+    uint32_t files; // non-zero writes one file per image instead of a mosaic
+} Atlas;
+
+int parse_atlas_grid(const char* text, Bound* grid);
+void make_atlas(Atlas* atlas, Bound grid, Bound image, Point center, uint32_t max_iterations, Colouring colouring, int files);
+void run_atlas(const Local_MPI_Types* types, Atlas* atlas, char* file_name, const Tuning* requested, int autotune, int bind, BufferPool* pool, MPI_Comm comm);
+
+#endif
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+// Ways of assembling the bands of an image on root
+typedef enum Strategy {
+    GATHER_PIXEL,
+    GATHER_BYTES,
+    GATHERV_PIXEL,
+    GATHERV_BYTES,
+    POINT_TO_POINT,
+    STRATEGIES,
+} Strategy;
+
+static const char* strategy_names[STRATEGIES] = {
+    "gather pixel",
+    "gather bytes",
+    "gatherv pixel",
+    "gatherv bytes",
+    "isend/irecv",
+};
+
+// Band layout of one measurement, in pixels and in bytes
+typedef struct Layout {
+    int pixels;
+    int* counts;
+    int* displs;
+    int* byte_counts;
+    int* byte_displs;
+    MPI_Request* requests;
+} Layout;
+
+// root's band is already in place, as it is when root colours into the image
+static void assemble(Strategy strategy, const Local_MPI_Types* types, const Pixel* band, Pixel* image, const Layout* layout, MPI_Comm comm)
+{
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    const void* send = rank == 0 ? MPI_IN_PLACE : band;
+    int bytes = layout->pixels * sizeof(Pixel);
+
+    switch (strategy) {
+    case GATHER_PIXEL:
+        MPI_Gather(send, layout->pixels, types->pixel_type, image, layout->pixels, types->pixel_type, 0, comm);
+        break;
+    case GATHER_BYTES:
+        MPI_Gather(send, bytes, MPI_BYTE, image, bytes, MPI_BYTE, 0, comm);
+        break;
+    case GATHERV_PIXEL:
+        MPI_Gatherv(send, layout->pixels, types->pixel_type, image, layout->counts, layout->displs, types->pixel_type, 0, comm);
+        break;
+    case GATHERV_BYTES:
+        MPI_Gatherv(send, bytes, MPI_BYTE, image, layout->byte_counts, layout->byte_displs, MPI_BYTE, 0, comm);
+        break;
+    default:
+        if (rank == 0) {
+            for (int r = 1; r < ranks; r++) {
+                MPI_Irecv((uint8_t*)image + layout->byte_displs[r], layout->byte_counts[r], MPI_BYTE, r, BENCH_TAG, comm, &layout->requests[r - 1]);
+            }
+            MPI_Waitall(ranks - 1, layout->requests, MPI_STATUSES_IGNORE);
+        } else {
+            MPI_Send(band, bytes, MPI_BYTE, 0, BENCH_TAG, comm);
+        }
+        break;
+    }
+}
+
+// every pixel of the image says which rank and offset it came from
+static Pixel pattern(int rank, int i)
+{
+    Pixel p = { rank, i, i >> 8 };
+    return p;
+}
+
+static int check_image(const Pixel* image, int pixels, int ranks)
+{
+    for (int r = 0; r < ranks; r++) {
+        for (int i = 0; i < pixels; i++) {
+            Pixel expected = pattern(r, i);
+            if (memcmp(&image[(size_t)r * pixels + i], &expected, sizeof(Pixel)) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// slowest rank's mean time per transfer
+static double time_assembly(Strategy strategy, int repeats, const Local_MPI_Types* types, const Pixel* band, Pixel* image, const Layout* layout, MPI_Comm comm)
+{
+    MPI_Barrier(comm);
+    double start = MPI_Wtime();
+    for (int i = 0; i < repeats; i++) {
+        assemble(strategy, types, band, image, layout, comm);
+    }
+    double elapsed = (MPI_Wtime() - start) / repeats, slowest;
+
+    MPI_Reduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    return slowest;
+}
+
+static int repeats_for(size_t bytes)
+{
+    size_t repeats = bytes > 0 ? BENCH_BYTES / bytes : BENCH_MAX_REPEATS;
+
+    if (repeats < BENCH_MIN_REPEATS) {
+        return BENCH_MIN_REPEATS;
+    }
+
+    return repeats > BENCH_MAX_REPEATS ? BENCH_MAX_REPEATS : repeats;
+}
+
+static void bench_bands(const Local_MPI_Types* types, Bound img, MPI_Comm comm)
+{
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    int max_rows = (img.height + ranks - 1) / ranks;
+    Pixel* band = malloc((size_t)max_rows * img.width * sizeof(Pixel));
+    Pixel* image = rank == 0 ? malloc((size_t)ranks * max_rows * img.width * sizeof(Pixel)) : NULL;
+
+    Layout layout;
+    layout.counts = malloc(ranks * sizeof(int));
+    layout.displs = malloc(ranks * sizeof(int));
+    layout.byte_counts = malloc(ranks * sizeof(int));
+    layout.byte_displs = malloc(ranks * sizeof(int));
+    layout.requests = malloc(ranks * sizeof(MPI_Request));
+
+    // band sizes double up to a full band of an image split over these ranks
+    for (int rows = 1;; rows = rows * 2 < max_rows ? rows * 2 : max_rows) {
+        layout.pixels = rows * img.width;
+        for (int r = 0; r < ranks; r++) {
+            layout.counts[r] = layout.pixels;
+            layout.displs[r] = r * layout.pixels;
+            layout.byte_counts[r] = layout.pixels * sizeof(Pixel);
+            layout.byte_displs[r] = r * layout.pixels * sizeof(Pixel);
+        }
+
+        size_t image_bytes = (size_t)ranks * layout.pixels * sizeof(Pixel);
+        int repeats = repeats_for(image_bytes);
+
+        for (int strategy = 0; strategy < STRATEGIES; strategy++) {
+            for (int i = 0; i < layout.pixels; i++) {
+                band[i] = pattern(rank, i);
+            }
+            if (rank == 0) {
+                memset(image, 0, image_bytes);
+                memcpy(image, band, layout.pixels * sizeof(Pixel));
+            }
+
+            // the first transfer warms up the connections and is checked
+            assemble(strategy, types, band, image, &layout, comm);
+            int failed = rank == 0 && check_image(image, layout.pixels, ranks) != 0;
+
+            double latency = time_assembly(strategy, repeats, types, band, image, &layout, comm);
+            if (rank == 0) {
+                printf("%5d  %-14s %12zu %8d %14.1f %14.1f%s\n", ranks, strategy_names[strategy],
+                    layout.pixels * sizeof(Pixel), repeats, latency * 1e6,
+                    latency > 0.0 ? image_bytes / latency / 1e6 : 0.0,
+                    failed ? "  (wrong data)" : "");
+            }
+        }
+
+        if (rows == max_rows) {
+            break;
+        }
+    }
+
+    free(band);
+    free(image);
+    free(layout.counts);
+    free(layout.displs);
+    free(layout.byte_counts);
+    free(layout.byte_displs);
+    free(layout.requests);
+}
+
+static void bench_workunits(const Local_MPI_Types* types, MPI_Comm comm)
+{
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    WorkUnit work;
+    WorkUnit* bands = rank == 0 ? calloc(ranks, sizeof(WorkUnit)) : NULL;
+    const char* names[] = { "scatter work", "scatter bytes" };
+
+    for (int as_bytes = 0; as_bytes < 2; as_bytes++) {
+        MPI_Datatype type = as_bytes ? MPI_BYTE : types->workunit_type;
+        int count = as_bytes ? sizeof(WorkUnit) : 1;
+
+        MPI_Scatter(bands, count, type, &work, count, type, 0, comm);
+        MPI_Barrier(comm);
+
+        double start = MPI_Wtime();
+        for (int i = 0; i < BENCH_MAX_REPEATS; i++) {
+            MPI_Scatter(bands, count, type, &work, count, type, 0, comm);
+        }
+        double elapsed = (MPI_Wtime() - start) / BENCH_MAX_REPEATS, slowest;
+
+        MPI_Reduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+        if (rank == 0) {
+            printf("%5d  %-14s %12zu %8d %14.1f %14.1f\n", ranks, names[as_bytes], sizeof(WorkUnit),
+                BENCH_MAX_REPEATS, slowest * 1e6, slowest > 0.0 ? ranks * sizeof(WorkUnit) / slowest / 1e6 : 0.0);
+        }
+    }
+
+    free(bands);
+}
+
+/*
+ * Collective: skips rendering and times the transfers a frame makes with
+ * synthetic data, on the first 2, 4, 8, ... ranks of comm and then all of
+ * them. Bands of the image root passes, from one row up to a full band, are
+ * assembled on root with the struct Pixel type and with plain bytes, by
+ * Gather, Gatherv and point-to-point messages; WorkUnits are scattered as
+ * structs and as bytes. Root prints the slowest rank's mean time per
+ * transfer and the image bytes assembled per second.
+ */
+void run_comm_benchmark(const Local_MPI_Types* types, Bound img, MPI_Comm comm)
+{
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    MPI_Bcast(&img, 1, types->bound_type, 0, comm);
+
+    if (rank == 0) {
+        printf("Communication benchmark, %u x %u image, up to %d ranks\n", img.width, img.height, ranks);
+        printf("ranks  transfer        band bytes  repeats   latency (us)  bandwidth (MB/s)\n");
+    }
+
+    for (int used = ranks > 1 ? 2 : 1;; used = used * 2 < ranks ? used * 2 : ranks) {
+        MPI_Comm sub;
+        MPI_Comm_split(comm, rank < used ? 0 : MPI_UNDEFINED, rank, &sub);
+
+        if (sub != MPI_COMM_NULL) {
+            bench_workunits(types, sub);
+            bench_bands(types, img, sub);
+            MPI_Comm_free(&sub);
+        }
+
+        // ranks left out wait here, so each measurement has the machine to itself
+        MPI_Barrier(comm);
+        if (used == ranks) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <mpi.h>
+
+#include "mpi_test.h"
+
+// Each measurement repeats a transfer until about this many bytes reach root,
+// within the repeat limits below
+#define BENCH_BYTES (1 << 26)
+#define BENCH_MIN_REPEATS 5
+#define BENCH_MAX_REPEATS 1000
+
+#define BENCH_TAG 2
+
+void run_comm_benchmark(const Local_MPI_Types* types, Bound img, MPI_Comm comm);
+
+#endif
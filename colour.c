@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "colour.h"
+
+int parse_colouring(const char* name, Colouring* colouring)
+{
+    if (name == NULL || strcmp(name, "linear") == 0) {
+        *colouring = COLOUR_LINEAR;
+    } else if (strcmp(name, "histogram") == 0) {
+        *colouring = COLOUR_HISTOGRAM;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+void make_linear_palette(Pixel* palette, uint32_t max_iterations)
+{
+    for (uint32_t i = 0; i <= max_iterations; i++) {
+        uint8_t c = (uint64_t)i * UINT8_MAX / max_iterations;
+
+        palette[i].red = c;
+        palette[i].green = c;
+        palette[i].blue = c;
+    }
+}
+
+void make_equalized_palette(Pixel* palette, const uint64_t* histogram, uint32_t max_iterations)
+{
+    uint64_t escaped = 0;
+    for (uint32_t i = 0; i < max_iterations; i++) {
+        escaped += histogram[i];
+    }
+
+    // each escaped count gets the fraction of escaped pixels at or below it,
+    // so the palette is spread evenly over the pixels rather than the counts
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < max_iterations; i++) {
+        seen += histogram[i];
+        double_t fraction = escaped > 0 ? (double_t)seen / escaped : 0.0;
+
+        Pixel_HSV hsv = { 240.0 * (1.0 - fraction), 1.0, fraction };
+        palette[i] = hsv2rgb(hsv);
+    }
+
+    Pixel interior = { 0, 0, 0 };
+    palette[max_iterations] = interior;
+}
+
+void build_histogram(uint64_t* histogram, const uint32_t* iterations, int count, uint32_t max_iterations)
+{
+    memset(histogram, 0, (max_iterations + 1) * sizeof(uint64_t));
+
+    for (int i = 0; i < count; i++) {
+        histogram[iterations[i]]++;
+    }
+}
+
+size_t colour_buffer_size(const WorkUnit* work)
+{
+    size_t entries = work->kernel.max_iterations + 1;
+
+    return pool_size(entries * sizeof(Pixel)) + pool_size(entries * sizeof(uint64_t));
+}
+
+// pixels are written tile by tile with render_work()'s thread mapping, the one touch_rows() placed them with
+void colour_band(const WorkUnit* work, const uint32_t* iterations, Pixel* pixels, const Tuning* tuning, BufferPool* pool, MPI_Comm comm)
+{
+    uint32_t max_iterations = work->kernel.max_iterations;
+    int count = bound_length(work->bound);
+
+    Pixel* palette = pool_get(pool, (max_iterations + 1) * sizeof(Pixel));
+
+    if (work->colouring == COLOUR_HISTOGRAM) {
+        uint64_t* histogram = pool_get(pool, (max_iterations + 1) * sizeof(uint64_t));
+
+        // every rank needs the whole-image histogram to colour its own pixels
+        build_histogram(histogram, iterations, count, max_iterations);
+        MPI_Allreduce(MPI_IN_PLACE, histogram, max_iterations + 1, MPI_UINT64_T, MPI_SUM, comm);
+        make_equalized_palette(palette, histogram, max_iterations);
+    } else {
+        make_linear_palette(palette, max_iterations);
+    }
+
+    int tile_rows = tuning->tile_rows > 0 ? tuning->tile_rows : TILE_ROWS;
+    int tiles = count_tiles(work, tuning);
+    int threads = tuning->threads > 0 ? tuning->threads : 1;
+    size_t width = work->bound.width;
+
+#pragma omp parallel for schedule(static, 1) num_threads(threads)
+    for (int tile = 0; tile < tiles; tile++) {
+        size_t first = tile * tile_rows * width;
+        size_t end = first + tile_rows * width < (size_t)count ? first + tile_rows * width : (size_t)count;
+
+        for (size_t i = first; i < end; i++) {
+            pixels[i] = palette[iterations[i]];
+        }
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef _COLOUR_H_
+#define _COLOUR_H_
+
+#include "kernels.h"
+#include "mpi_test.h"
+#include "pool.h"
+
+typedef enum Colouring {
+    COLOUR_LINEAR,
+    COLOUR_HISTOGRAM,
+} Colouring;
+
+int parse_colouring(const char* name, Colouring* colouring);
+
+// Palettes map every iteration count 0..max_iterations to a colour
+void make_linear_palette(Pixel* palette, uint32_t max_iterations);
+void make_equalized_palette(Pixel* palette, const uint64_t* histogram, uint32_t max_iterations);
+
+void build_histogram(uint64_t* histogram, const uint32_t* iterations, int count, uint32_t max_iterations);
+
+size_t colour_buffer_size(const WorkUnit* work);
+void colour_band(const WorkUnit* work, const uint32_t* iterations, Pixel* pixels, const Tuning* tuning, BufferPool* pool, MPI_Comm comm);
+
+#endif
@@ -0,0 +1,296 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "colour.h"
+#include "density.h"
+
+int parse_render_mode(const char* name, RenderMode* mode)
+{
+    if (name == NULL || strcmp(name, "escape") == 0) {
+        *mode = RENDER_ESCAPE;
+    } else if (strcmp(name, "density") == 0) {
+        *mode = RENDER_DENSITY;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Density levels are coloured like iteration counts with DENSITY_LEVELS as the limit
+void density_palette_work(WorkUnit* palette, const WorkUnit* work)
+{
+    *palette = *work;
+    palette->kernel.max_iterations = DENSITY_LEVELS;
+}
+
+// splitmix64, so every batch gets an independent stream from its index alone
+static uint64_t next_random(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double next_uniform(uint64_t* state)
+{
+    return (next_random(state) >> 11) * 0x1.0p-53;
+}
+
+static Point cell_point(int cell, uint64_t* state)
+{
+    const double size = 2.0 * SAMPLE_RADIUS / DENSITY_CELLS;
+    Point p = {
+        -SAMPLE_RADIUS + size * (cell % DENSITY_CELLS + next_uniform(state)),
+        -SAMPLE_RADIUS + size * (cell / DENSITY_CELLS + next_uniform(state)),
+    };
+
+    return p;
+}
+
+// nearest pixel of the whole image, or -1 outside the view
+static int64_t pixel_index(const WorkUnit* work, Bound img, Point z)
+{
+    double x = (z.x - work->origin.x) / work->step.x + 0.5;
+    double y = (work->origin.y - z.y) / work->step.y + 0.5;
+
+    if (!(x >= 0.0 && y >= 0.0 && x < img.width && y < img.height)) {
+        return -1;
+    }
+
+    return (int64_t)y * img.width + (int64_t)x;
+}
+
+/*
+ * Collective: every cell is probed with a few uniform points and weighted by
+ * how many orbit points they land in the view. Cells are then sampled in
+ * proportion to their weight and every sample deposits the inverse of its
+ * relative probability, so the density is unbiased. A floor keeps every cell
+ * reachable.
+ */
+static void build_importance(double* cdf, float* deposit, const WorkUnit* work, Bound img, OrbitFunction orbit, int threads, MPI_Comm comm)
+{
+    const int cells = DENSITY_CELLS * DENSITY_CELLS;
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    double* weight = calloc(cells, sizeof(double));
+
+#pragma omp parallel num_threads(threads)
+    {
+        Point* path = malloc(work->kernel.max_iterations * sizeof(Point));
+
+#pragma omp for schedule(dynamic)
+        for (int cell = rank; cell < cells; cell += ranks) {
+            uint64_t state = ~(uint64_t)cell;
+            uint64_t landed = 0;
+
+            for (int i = 0; i < DENSITY_PILOT; i++) {
+                uint32_t length = orbit(&work->kernel, cell_point(cell, &state), path);
+                for (uint32_t k = 0; k < length; k++) {
+                    landed += pixel_index(work, img, path[k]) >= 0;
+                }
+            }
+
+            weight[cell] = (double)landed / DENSITY_PILOT;
+        }
+
+        free(path);
+    }
+
+    MPI_Allreduce(MPI_IN_PLACE, weight, cells, MPI_DOUBLE, MPI_SUM, comm);
+
+    double total = 0.0;
+    for (int cell = 0; cell < cells; cell++) {
+        total += weight[cell];
+    }
+
+    double floor = total > 0.0 ? DENSITY_FLOOR * total / cells : 1.0;
+    double sum = 0.0;
+    for (int cell = 0; cell < cells; cell++) {
+        weight[cell] += floor;
+        sum += weight[cell];
+    }
+
+    double running = 0.0;
+    for (int cell = 0; cell < cells; cell++) {
+        running += weight[cell];
+        cdf[cell] = running / sum;
+        deposit[cell] = sum / (cells * weight[cell]);
+    }
+    cdf[cells - 1] = 1.0;
+
+    free(weight);
+}
+
+static int pick_cell(const double* cdf, double u)
+{
+    int low = 0, high = DENSITY_CELLS * DENSITY_CELLS - 1;
+
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (cdf[mid] < u) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+static int thread_id(void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+static int overlap(int first, int end, int other_first, int other_end)
+{
+    int low = first > other_first ? first : other_first;
+    int high = end < other_end ? end : other_end;
+
+    return high > low ? high - low : 0;
+}
+
+/*
+ * Collective: every rank draws its share of work->samples per image pixel.
+ * The image is covered in strips of rows, each small enough for every thread
+ * to keep a private grid of it so the hot loop never shares a cache line.
+ * Once all batches of a strip are drawn the threads sum their grids, each
+ * over its own range of pixels, and MPI_Reduce_scatter sums the strip over
+ * the ranks and hands each its share of it, so no rank ever holds more than
+ * a strip per thread and its own band. The band is then quantised into
+ * levels.
+ */
+void render_density(const WorkUnit* work, Bound img, uint32_t* levels, const Tuning* tuning, MPI_Comm comm)
+{
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    const int cells = DENSITY_CELLS * DENSITY_CELLS;
+    const int width = img.width;
+    const int threads = tuning->threads > 0 ? tuning->threads : 1;
+    OrbitFunction orbit = select_orbit(&work->kernel);
+
+    double* cdf = malloc(cells * sizeof(double));
+    float* deposit = malloc(cells * sizeof(float));
+    build_importance(cdf, deposit, work, img, orbit, threads, comm);
+
+    // hosts may run different thread counts, but every rank must cut the same strips
+    int strip_rows = DENSITY_STRIP_BYTES / ((size_t)threads * width * sizeof(double));
+    strip_rows = strip_rows < 1 ? 1 : (strip_rows > (int)img.height ? (int)img.height : strip_rows);
+    MPI_Allreduce(MPI_IN_PLACE, &strip_rows, 1, MPI_INT, MPI_MIN, comm);
+    int passes = (img.height + strip_rows - 1) / strip_rows;
+    if (rank == 0 && passes > 1) {
+        printf("Density: %d passes of %d rows to stay within %d MB of grids per rank\n", passes, strip_rows, DENSITY_STRIP_BYTES >> 20);
+    }
+
+    uint64_t total = (uint64_t)work->samples * bound_length(img);
+    int64_t batches = (total + DENSITY_BATCH - 1) / DENSITY_BATCH;
+
+    int* first_rows = malloc(ranks * sizeof(int));
+    int* counts = malloc(ranks * sizeof(int));
+    int first_row = work->row_offset;
+    MPI_Allgather(&first_row, 1, MPI_INT, first_rows, 1, MPI_INT, comm);
+
+    int length = bound_length(work->bound);
+    double* band = malloc((length > 0 ? length : 1) * sizeof(double));
+    double** grids = calloc(threads, sizeof(double*));
+
+    for (int strip_first = 0; strip_first < (int)img.height; strip_first += strip_rows) {
+        int strip_end = strip_first + strip_rows < (int)img.height ? strip_first + strip_rows : (int)img.height;
+        int64_t strip_offset = (int64_t)strip_first * width;
+        size_t strip_pixels = (size_t)(strip_end - strip_first) * width;
+
+#pragma omp parallel num_threads(threads)
+        {
+            double* grid = grids[thread_id()];
+            if (grid == NULL) {
+                grid = grids[thread_id()] = malloc((size_t)strip_rows * width * sizeof(double));
+            }
+            memset(grid, 0, strip_pixels * sizeof(double));
+            Point* path = malloc(work->kernel.max_iterations * sizeof(Point));
+
+#pragma omp for schedule(dynamic)
+            for (int64_t batch = rank; batch < batches; batch += ranks) {
+                uint64_t state = batch;
+                uint64_t count = total - batch * DENSITY_BATCH < DENSITY_BATCH ? total - batch * DENSITY_BATCH : DENSITY_BATCH;
+
+                for (uint64_t i = 0; i < count; i++) {
+                    int cell = pick_cell(cdf, next_uniform(&state));
+                    uint32_t length = orbit(&work->kernel, cell_point(cell, &state), path);
+
+                    for (uint32_t k = 0; k < length; k++) {
+                        int64_t index = pixel_index(work, img, path[k]) - strip_offset;
+                        if (index >= 0 && index < (int64_t)strip_pixels) {
+                            grid[index] += deposit[cell];
+                        }
+                    }
+                }
+            }
+
+            // the barrier above has every grid complete; thread 0's grid collects the sums
+#pragma omp for schedule(static)
+            for (size_t p = 0; p < strip_pixels; p++) {
+                double sum = 0.0;
+                for (int t = 1; t < threads; t++) {
+                    sum += grids[t] ? grids[t][p] : 0.0;
+                }
+                grids[0][p] += sum;
+            }
+
+            free(path);
+        }
+
+        // bands are in rank order, so each rank's share of the strip follows the previous one's
+        for (int r = 0; r < ranks; r++) {
+            int end_row = r + 1 < ranks ? first_rows[r + 1] : (int)img.height;
+            counts[r] = overlap(strip_first, strip_end, first_rows[r], end_row) * width;
+        }
+
+        int band_first = strip_first > first_row ? strip_first - first_row : 0;
+        MPI_Reduce_scatter(grids[0], band + (size_t)band_first * width, counts, MPI_DOUBLE, MPI_SUM, comm);
+    }
+
+    for (int t = 0; t < threads; t++) {
+        free(grids[t]);
+    }
+    free(grids);
+    free(first_rows);
+    free(counts);
+    free(cdf);
+    free(deposit);
+
+    double peak = 0.0;
+    for (int i = 0; i < length; i++) {
+        peak = band[i] > peak ? band[i] : peak;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &peak, 1, MPI_DOUBLE, MPI_MAX, comm);
+
+    // square root brings out the faint outer orbits; histogram colouring keeps
+    // empty pixels black by giving them the interior level
+    for (int i = 0; i < length; i++) {
+        if (band[i] == 0.0 && work->colouring == COLOUR_HISTOGRAM) {
+            levels[i] = DENSITY_LEVELS;
+        } else {
+            double level = peak > 0.0 ? sqrt(band[i] / peak) * (DENSITY_LEVELS - 1) : 0.0;
+            levels[i] = (uint32_t)level;
+        }
+    }
+
+    free(band);
+}
@@ -0,0 +1,40 @@
+#ifndef _DENSITY_H_
+#define _DENSITY_H_
+
+#include "kernels.h"
+#include "mpi_test.h"
+
+typedef enum RenderMode {
+    RENDER_ESCAPE, // escape time per pixel
+    RENDER_DENSITY, // Buddhabrot style density of escaping orbits
+} RenderMode;
+
+// Density is quantised to this many levels for colouring
+#define DENSITY_LEVELS 256
+
+#define DENSITY_SAMPLES 16
+
+// Points are sampled from the square of this half-width around the origin,
+// stratified into DENSITY_CELLS x DENSITY_CELLS importance cells that are each
+// probed with DENSITY_PILOT points first
+#define SAMPLE_RADIUS 2.0
+#define DENSITY_CELLS 64
+#define DENSITY_PILOT 16
+
+// Every cell is sampled at least this fraction of the mean cell rate
+#define DENSITY_FLOOR 0.1
+
+// Samples drawn per random stream, handed to the threads a batch at a time
+#define DENSITY_BATCH (1 << 18)
+
+// A rank's per-thread grids together cover a strip of image rows that fits
+// in this many bytes. Larger images are rendered one strip at a time, every
+// pass tracing all of the rank's orbits again.
+#define DENSITY_STRIP_BYTES (64 << 20)
+
+int parse_render_mode(const char* name, RenderMode* mode);
+
+void density_palette_work(WorkUnit* palette, const WorkUnit* work);
+void render_density(const WorkUnit* work, Bound img, uint32_t* levels, const Tuning* tuning, MPI_Comm comm);
+
+#endif
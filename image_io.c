@@ -0,0 +1,255 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef USE_GRAPHICSMAGICK
+#include <magick/api.h>
+#endif
+
+#include "image_io.h"
+#include "png_encode.h"
+#include "pool.h"
+
+static int has_extension(const char* file_name, const char* extension)
+{
+    const char* dot = strrchr(file_name, '.');
+
+    return dot != NULL && strcasecmp(dot + 1, extension) == 0;
+}
+
+ImageFormat image_format(const char* file_name)
+{
+    if (has_extension(file_name, "raw")) {
+        return FORMAT_RAW;
+    } else if (has_extension(file_name, "pgm")) {
+        return FORMAT_PGM;
+    } else if (has_extension(file_name, "ppm")) {
+        return FORMAT_PPM;
+    } else if (has_extension(file_name, "png")) {
+        return FORMAT_PNG;
+    } else if (has_extension(file_name, "dzi")) {
+        return FORMAT_DZI;
+    } else if (has_extension(file_name, "y4m") || strcmp(file_name, "-") == 0) {
+        return FORMAT_Y4M;
+    }
+
+    return FORMAT_MAGICK;
+}
+
+int native_format(ImageFormat format)
+{
+    return format == FORMAT_RAW || format == FORMAT_PGM || format == FORMAT_PPM;
+}
+
+size_t format_pixel_size(ImageFormat format)
+{
+    return format == FORMAT_PGM ? 1 : sizeof(Pixel);
+}
+
+size_t image_header(ImageFormat format, Bound size, char* header)
+{
+    switch (format) {
+    case FORMAT_PGM:
+        return snprintf(header, IMAGE_HEADER_MAX, "P5\n%u %u\n255\n", size.width, size.height);
+    case FORMAT_PPM:
+        return snprintf(header, IMAGE_HEADER_MAX, "P6\n%u %u\n255\n", size.width, size.height);
+    default:
+        header[0] = '\0';
+        return 0;
+    }
+}
+
+int parse_output_mode(const char* name, OutputMode* mode)
+{
+    if (name == NULL || strcmp(name, "gather") == 0) {
+        *mode = OUTPUT_GATHER;
+    } else if (strcmp(name, "parallel") == 0) {
+        *mode = OUTPUT_PARALLEL;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+// frames of a sequence are numbered before the extension, zoom.png -> zoom_0003.png,
+// except in a video where they all go to the one stream
+void frame_file_name(char* name, const char* file_name, uint32_t frame, uint32_t frames)
+{
+    const char* dot = strrchr(file_name, '.');
+    int stem = dot ? (int)(dot - file_name) : (int)strlen(file_name);
+
+    if (frames <= 1 || image_format(file_name) == FORMAT_Y4M) {
+        snprintf(name, OUTPUT_NAME_MAX, "%s", file_name);
+    } else {
+        snprintf(name, OUTPUT_NAME_MAX, "%.*s_%04u%s", stem, file_name, frame, dot ? dot : "");
+    }
+}
+
+int map_image(MappedImage* image, const char* file_name, ImageFormat format, Bound size, int first_row, int rows, int create)
+{
+    char header[IMAGE_HEADER_MAX];
+    size_t header_length = image_header(format, size, header);
+    size_t row_length = (size_t)size.width * format_pixel_size(format);
+
+    image->fd = -1;
+    image->map = NULL;
+    image->map_length = 0;
+    image->pixels = NULL;
+
+    image->fd = open(file_name, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+    if (image->fd < 0) {
+        perror(file_name);
+        return -1;
+    }
+
+    if (create) {
+        off_t file_length = header_length + row_length * size.height;
+
+        if (ftruncate(image->fd, file_length) != 0
+            || pwrite(image->fd, header, header_length, 0) != (ssize_t)header_length) {
+            perror(file_name);
+            unmap_image(image);
+            return -1;
+        }
+    }
+
+    if (rows == 0) {
+        return 0;
+    }
+
+    // mmap offsets must be page aligned, so the window may start a little early
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t offset = header_length + row_length * first_row;
+    size_t map_offset = offset & ~(page - 1);
+
+    image->map_length = offset - map_offset + row_length * rows;
+    image->map = mmap(NULL, image->map_length, PROT_READ | PROT_WRITE, MAP_SHARED, image->fd, map_offset);
+    if (image->map == MAP_FAILED) {
+        perror(file_name);
+        image->map = NULL;
+        unmap_image(image);
+        return -1;
+    }
+
+    image->pixels = (uint8_t*)image->map + (offset - map_offset);
+    return 0;
+}
+
+void unmap_image(MappedImage* image)
+{
+    if (image->map) {
+        msync(image->map, image->map_length, MS_SYNC);
+        munmap(image->map, image->map_length);
+        image->map = NULL;
+    }
+
+    if (image->fd >= 0) {
+        close(image->fd);
+        image->fd = -1;
+    }
+
+    image->pixels = NULL;
+}
+
+void store_pixels(uint8_t* dest, const Pixel* pixels, int count, ImageFormat format)
+{
+    if (format == FORMAT_PGM) {
+        for (int i = 0; i < count; i++) {
+            dest[i] = (77 * pixels[i].red + 150 * pixels[i].green + 29 * pixels[i].blue) >> 8;
+        }
+    } else if (dest != (const uint8_t*)pixels) {
+        memcpy(dest, pixels, count * sizeof(Pixel));
+    }
+}
+
+#ifdef USE_GRAPHICSMAGICK
+static int magick_initialized = 0;
+
+static int write_magick(const Pixel* pixels, Bound size, const char* file_name)
+{
+    ExceptionInfo exception;
+
+    if (!magick_initialized) {
+        InitializeMagick(NULL);
+        magick_initialized = 1;
+    }
+
+    GetExceptionInfo(&exception);
+    Image* image = ConstituteImage(size.width, size.height, "RGB", CharPixel, pixels, &exception);
+    if (image == NULL) {
+        CatchException(&exception);
+        DestroyExceptionInfo(&exception);
+        return -1;
+    }
+
+    ImageInfo* image_info = CloneImageInfo(0);
+    strncpy(image->filename, file_name, MaxTextExtent - 1);
+    image->filename[MaxTextExtent - 1] = '\0';
+
+    int result = 0;
+    if (!WriteImage(image_info, image)) {
+        CatchException(&image->exception);
+        result = -1;
+    }
+
+    DestroyImage(image);
+    DestroyImageInfo(image_info);
+    DestroyExceptionInfo(&exception);
+    return result;
+}
+#endif
+
+// keyword and text, unless NULL, are kept in a PNG as a tEXt chunk; other formats drop them
+int write_image(const Pixel* pixels, Bound size, const char* file_name, const char* keyword, const char* text)
+{
+    ImageFormat format = image_format(file_name);
+
+    if (native_format(format)) {
+        MappedImage image;
+        if (map_image(&image, file_name, format, size, 0, size.height, 1) != 0) {
+            return -1;
+        }
+
+        store_pixels(image.pixels, pixels, bound_length(size), format);
+        unmap_image(&image);
+        return 0;
+    }
+
+    if (format == FORMAT_PNG) {
+        BufferPool pool;
+        EncodedBand band;
+
+        pool_init(&pool);
+        pool_reserve(&pool, png_band_buffer_size(size));
+
+        int result = encode_png_band(&band, pixels, size, 1, 1, &pool);
+        if (result == 0) {
+            result = write_png_bands(&band, size, file_name, keyword, text, 0, MPI_COMM_SELF);
+        }
+
+        pool_free(&pool);
+        return result;
+    }
+
+#ifdef USE_GRAPHICSMAGICK
+    return write_magick(pixels, size, file_name);
+#else
+    printf("%s: built without GraphicsMagick, only .raw, .pgm, .ppm and .png output is available\n", file_name);
+    return -1;
+#endif
+}
+
+void shutdown_image_io(void)
+{
+#ifdef USE_GRAPHICSMAGICK
+    if (magick_initialized) {
+        DestroyMagick();
+        magick_initialized = 0;
+    }
+#endif
+}
@@ -0,0 +1,49 @@
+#ifndef _IMAGE_IO_H_
+#define _IMAGE_IO_H_
+
+#include "mpi_test.h"
+
+typedef enum ImageFormat {
+    FORMAT_RAW, // headerless 8-bit RGB, row major
+    FORMAT_PGM,
+    FORMAT_PPM,
+    FORMAT_PNG, // deflated band by band by the ranks themselves
+    FORMAT_DZI, // Deep Zoom tile pyramid, every rank writes the tiles of its rows
+    FORMAT_Y4M, // YUV4MPEG2 video of every frame, to a file, a FIFO or "-" for stdout
+    FORMAT_MAGICK, // anything else, encoded by GraphicsMagick
+} ImageFormat;
+
+typedef enum OutputMode {
+    OUTPUT_GATHER, // bands are gathered on root, which writes the file
+    OUTPUT_PARALLEL, // every rank writes its band into the shared output file
+} OutputMode;
+
+#define IMAGE_HEADER_MAX 64
+#define OUTPUT_NAME_MAX 1024
+
+ImageFormat image_format(const char* file_name);
+int native_format(ImageFormat format);
+size_t format_pixel_size(ImageFormat format);
+size_t image_header(ImageFormat format, Bound size, char* header);
+
+int parse_output_mode(const char* name, OutputMode* mode);
+void frame_file_name(char* name, const char* file_name, uint32_t frame, uint32_t frames);
+
+// A window of rows of a native format image file mapped into memory. Bytes
+// written to pixels land in the file at their final offset.
+typedef struct MappedImage {
+    int fd;
+    void* map;
+    size_t map_length;
+    uint8_t* pixels;
+} MappedImage;
+
+int map_image(MappedImage* image, const char* file_name, ImageFormat format, Bound size, int first_row, int rows, int create);
+void unmap_image(MappedImage* image);
+
+void store_pixels(uint8_t* dest, const Pixel* pixels, int count, ImageFormat format);
+
+int write_image(const Pixel* pixels, Bound size, const char* file_name, const char* keyword, const char* text);
+void shutdown_image_io(void);
+
+#endif
@@ -0,0 +1,726 @@
+#include <assert.h>
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+
+// the STEP macros call fabs() on real_t, which must stay float in the float kernels
+#include <tgmath.h>
+
+#include "kernels.h"
+
+static const char* fractal_names[] = {
+    [FRACTAL_MANDELBROT] = "mandelbrot",
+    [FRACTAL_JULIA] = "julia",
+    [FRACTAL_MULTIBROT] = "multibrot",
+    [FRACTAL_BURNING_SHIP] = "burning-ship",
+    [FRACTAL_TRICORN] = "tricorn",
+};
+
+#define FRACTAL_KINDS (sizeof(fractal_names) / sizeof(fractal_names[0]))
+
+int parse_fractal_kind(const char* name, FractalKind* kind)
+{
+    if (name == NULL) {
+        *kind = FRACTAL_MANDELBROT;
+        return 0;
+    }
+
+    for (int i = 0; i < FRACTAL_KINDS; i++) {
+        if (strcmp(name, fractal_names[i]) == 0) {
+            *kind = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+const char* fractal_kind_name(FractalKind kind)
+{
+    return kind < FRACTAL_KINDS ? fractal_names[kind] : "unknown";
+}
+
+void make_kernel(Kernel* kernel, FractalKind kind, int power, Point c, int max_iterations)
+{
+    kernel->kind = kind;
+    kernel->power = power;
+    kernel->max_iterations = max_iterations;
+    kernel->c = c;
+
+    // z^2 + c is Mandelbrot, keep a single specialization for it
+    if (kind == FRACTAL_MULTIBROT && power == 2) {
+        kernel->kind = FRACTAL_MANDELBROT;
+    }
+}
+
+void default_view(const Kernel* kernel, Point* center, RectSize* size)
+{
+    switch (kernel->kind) {
+    case FRACTAL_JULIA:
+    case FRACTAL_MULTIBROT:
+    case FRACTAL_TRICORN:
+        center->x = 0.0;
+        center->y = 0.0;
+        size->width = 3.0;
+        size->height = 3.0;
+        break;
+    case FRACTAL_BURNING_SHIP:
+        center->x = -0.4;
+        center->y = -0.5;
+        size->width = 3.0;
+        size->height = 3.0;
+        break;
+    default:
+        center->x = -0.5;
+        center->y = 0.0;
+        size->width = 2.5;
+        size->height = 2.5;
+        break;
+    }
+}
+
+// Kernels whose escape counts at conj(p) match those at p exactly: the
+// Burning Ship folds the imaginary part and a Julia set is only mirrored
+// for real c.
+int kernel_is_mirrored(const Kernel* kernel)
+{
+    switch (kernel->kind) {
+    case FRACTAL_MANDELBROT:
+    case FRACTAL_MULTIBROT:
+    case FRACTAL_TRICORN:
+        return 1;
+    case FRACTAL_JULIA:
+        return kernel->c.y == 0.0;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Each kernel is stamped out from the same loop with its formula pasted in, so
+ * the compiler sees a straight-line iteration with no calls or branches on the
+ * fractal type. INIT sets z and c from the pixel position p and the Julia
+ * parameter (jx, jy); STEP advances z by one iteration in real_t, the working
+ * precision of the kernel. Both are passed through two levels of macros, so
+ * they must not contain bare commas.
+ */
+#define DEFINE_SCALAR_KERNEL(NAME, INIT, STEP)                                  \
+    static void kernel_##NAME##_scalar(const WorkUnit* work, int first_row,    \
+        int end_row, uint32_t* iterations)                                     \
+    {                                                                          \
+        typedef double_t real_t;                                               \
+        const uint32_t max_iterations = work->kernel.max_iterations;           \
+        const double_t jx = work->kernel.c.x;                                  \
+        const double_t jy = work->kernel.c.y;                                  \
+        const double_t dx = work->step.x;                                      \
+        const double_t dy = work->step.y;                                      \
+        (void)jx;                                                              \
+        (void)jy;                                                              \
+                                                                               \
+        for (int y = first_row; y < end_row; y++) {                            \
+            int x_first;                                                       \
+            const int x_step = rendered_columns(work, work->row_offset + y,    \
+                                   &x_first) == work->bound.width ? 1 : 2;     \
+                                                                               \
+            for (int x = x_first; x < work->bound.width; x += x_step) {        \
+                /* same arithmetic as map_coord_to_point(), kept inline */     \
+                Point p = { work->origin.x + dx * x,                           \
+                    work->origin.y - dy * (int)(work->row_offset + y) };       \
+                double_t zx, zy, cx, cy;                                       \
+                INIT;                                                          \
+                                                                               \
+                uint32_t i;                                                    \
+                for (i = 0; i < max_iterations; i++) {                         \
+                    STEP;                                                      \
+                    if (zx * zx + zy * zy >= 4.0) {                            \
+                        break;                                                 \
+                    }                                                          \
+                }                                                              \
+                                                                               \
+                iterations[bound_index(x, y, work->bound)] = i;                \
+            }                                                                  \
+        }                                                                      \
+    }
+
+/*
+ * The batched variant iterates KERNEL_LANES neighbouring pixels in lock step
+ * so the lane loop can be vectorized. Escaped lanes keep iterating but stop
+ * counting, which gives the same counts as the scalar loop.
+ */
+#define DEFINE_BATCHED_KERNEL(NAME, INIT, STEP)                                 \
+    static void kernel_##NAME##_batched(const WorkUnit* work, int first_row,   \
+        int end_row, uint32_t* iterations)                                     \
+    {                                                                          \
+        typedef double_t real_t;                                               \
+        const uint32_t max_iterations = work->kernel.max_iterations;           \
+        const double_t jx = work->kernel.c.x;                                  \
+        const double_t jy = work->kernel.c.y;                                  \
+        const double_t dx = work->step.x;                                      \
+        const double_t dy = work->step.y;                                      \
+        const int width = work->bound.width;                                   \
+        (void)jx;                                                              \
+        (void)jy;                                                              \
+                                                                               \
+        for (int y = first_row; y < end_row; y++) {                            \
+            const double_t row_y = work->origin.y                              \
+                - dy * (int)(work->row_offset + y);                            \
+            int x_first;                                                       \
+            const int x_step = rendered_columns(work, work->row_offset + y,    \
+                                   &x_first) == width ? 1 : 2;                 \
+                                                                               \
+            for (int x0 = x_first; x0 < width; x0 += KERNEL_LANES * x_step) {  \
+                double_t lane_zx[KERNEL_LANES], lane_zy[KERNEL_LANES];         \
+                double_t lane_cx[KERNEL_LANES], lane_cy[KERNEL_LANES];         \
+                uint32_t count[KERNEL_LANES];                                  \
+                int live[KERNEL_LANES];                                        \
+                                                                               \
+                for (int l = 0; l < KERNEL_LANES; l++) {                       \
+                    Point p = { work->origin.x + dx * (x0 + l * x_step),       \
+                        row_y };                                               \
+                    double_t zx, zy, cx, cy;                                   \
+                    INIT;                                                      \
+                    lane_zx[l] = zx;                                           \
+                    lane_zy[l] = zy;                                           \
+                    lane_cx[l] = cx;                                           \
+                    lane_cy[l] = cy;                                           \
+                    count[l] = 0;                                              \
+                    live[l] = x0 + l * x_step < width;                         \
+                }                                                              \
+                                                                               \
+                for (uint32_t i = 0; i < max_iterations; i++) {                \
+                    int any = 0;                                               \
+                    for (int l = 0; l < KERNEL_LANES; l++) {                   \
+                        double_t zx = lane_zx[l], zy = lane_zy[l];             \
+                        double_t cx = lane_cx[l], cy = lane_cy[l];             \
+                        STEP;                                                  \
+                        live[l] &= zx * zx + zy * zy < 4.0;                    \
+                        count[l] += live[l];                                   \
+                        lane_zx[l] = zx;                                       \
+                        lane_zy[l] = zy;                                       \
+                        any |= live[l];                                        \
+                    }                                                          \
+                    if (!any) {                                                \
+                        break;                                                 \
+                    }                                                          \
+                }                                                              \
+                                                                               \
+                for (int l = 0; l < KERNEL_LANES && x0 + l * x_step < width;   \
+                     l++) {                                                    \
+                    iterations[bound_index(x0 + l * x_step, y, work->bound)]   \
+                        = count[l];                                            \
+                }                                                              \
+            }                                                                  \
+        }                                                                      \
+    }
+
+/*
+ * The float variant is the batched loop in single precision with twice the
+ * lanes, and the lane loop is marked for OpenMP SIMD since compilers do not
+ * find it worth vectorizing on their own. Pixel positions are still worked
+ * out in double and rounded once, so it only differs from the double kernels
+ * by the precision of the orbit.
+ */
+#define DEFINE_FLOAT_KERNEL(NAME, INIT, STEP)                                  \
+    static void kernel_##NAME##_float(const WorkUnit* work, int first_row,     \
+        int end_row, uint32_t* iterations)                                     \
+    {                                                                          \
+        typedef float real_t;                                                  \
+        const uint32_t max_iterations = work->kernel.max_iterations;           \
+        const real_t jx = work->kernel.c.x;                                    \
+        const real_t jy = work->kernel.c.y;                                    \
+        const double_t dx = work->step.x;                                      \
+        const double_t dy = work->step.y;                                      \
+        const int width = work->bound.width;                                   \
+        (void)jx;                                                              \
+        (void)jy;                                                              \
+                                                                               \
+        for (int y = first_row; y < end_row; y++) {                            \
+            const double_t row_y = work->origin.y                              \
+                - dy * (int)(work->row_offset + y);                            \
+            int x_first;                                                       \
+            const int x_step = rendered_columns(work, work->row_offset + y,    \
+                                   &x_first) == width ? 1 : 2;                 \
+                                                                               \
+            for (int x0 = x_first; x0 < width; x0 += FLOAT_LANES * x_step) {   \
+                real_t lane_zx[FLOAT_LANES], lane_zy[FLOAT_LANES];             \
+                real_t lane_cx[FLOAT_LANES], lane_cy[FLOAT_LANES];             \
+                uint32_t count[FLOAT_LANES];                                   \
+                int live[FLOAT_LANES];                                         \
+                                                                               \
+                for (int l = 0; l < FLOAT_LANES; l++) {                        \
+                    Point p = { work->origin.x + dx * (x0 + l * x_step),       \
+                        row_y };                                               \
+                    real_t zx, zy, cx, cy;                                     \
+                    INIT;                                                      \
+                    lane_zx[l] = zx;                                           \
+                    lane_zy[l] = zy;                                           \
+                    lane_cx[l] = cx;                                           \
+                    lane_cy[l] = cy;                                           \
+                    count[l] = 0;                                              \
+                    live[l] = x0 + l * x_step < width;                         \
+                }                                                              \
+                                                                               \
+                for (uint32_t i = 0; i < max_iterations; i++) {                \
+                    int any = 0;                                               \
+                    _Pragma("omp simd reduction(| : any)")                     \
+                    for (int l = 0; l < FLOAT_LANES; l++) {                    \
+                        real_t zx = lane_zx[l], zy = lane_zy[l];               \
+                        real_t cx = lane_cx[l], cy = lane_cy[l];               \
+                        STEP;                                                  \
+                        live[l] &= zx * zx + zy * zy < 4.0f;                   \
+                        count[l] += live[l];                                   \
+                        lane_zx[l] = zx;                                       \
+                        lane_zy[l] = zy;                                       \
+                        any |= live[l];                                        \
+                    }                                                          \
+                    if (!any) {                                                \
+                        break;                                                 \
+                    }                                                          \
+                }                                                              \
+                                                                               \
+                for (int l = 0; l < FLOAT_LANES && x0 + l * x_step < width;    \
+                     l++) {                                                    \
+                    iterations[bound_index(x0 + l * x_step, y, work->bound)]   \
+                        = count[l];                                            \
+                }                                                              \
+            }                                                                  \
+        }                                                                      \
+    }
+
+/*
+ * The orbit variant iterates a single point p and records every z it visits
+ * before escaping, for the orbit density renderer.
+ */
+#define DEFINE_ORBIT_KERNEL(NAME, INIT, STEP)                                   \
+    static uint32_t orbit_##NAME(const Kernel* kernel, Point p, Point* orbit)  \
+    {                                                                          \
+        typedef double_t real_t;                                               \
+        const uint32_t max_iterations = kernel->max_iterations;                \
+        const double_t jx = kernel->c.x;                                       \
+        const double_t jy = kernel->c.y;                                       \
+        double_t zx, zy, cx, cy;                                               \
+        (void)jx;                                                              \
+        (void)jy;                                                              \
+        INIT;                                                                  \
+                                                                               \
+        for (uint32_t i = 0; i < max_iterations; i++) {                        \
+            STEP;                                                              \
+            if (zx * zx + zy * zy >= 4.0) {                                    \
+                return i;                                                      \
+            }                                                                  \
+            orbit[i].x = zx;                                                   \
+            orbit[i].y = zy;                                                   \
+        }                                                                      \
+                                                                               \
+        return 0;                                                              \
+    }
+
+/*
+ * The resume variant continues a list of pixels from saved z and iteration
+ * counts, with the same arithmetic as the scalar loop so a render refined in
+ * stages ends with exactly the counts of a single render at the final limit.
+ */
+#define DEFINE_RESUME_KERNEL(NAME, INIT, STEP)                                  \
+    static void resume_##NAME(const WorkUnit* work, uint32_t width,            \
+        PendingPixel* pending, int first, int end, uint32_t max_iterations)    \
+    {                                                                          \
+        typedef double_t real_t;                                               \
+        const double_t jx = work->kernel.c.x;                                  \
+        const double_t jy = work->kernel.c.y;                                  \
+        const double_t dx = work->step.x;                                      \
+        const double_t dy = work->step.y;                                      \
+        (void)jx;                                                              \
+        (void)jy;                                                              \
+                                                                               \
+        for (int n = first; n < end; n++) {                                    \
+            int x = pending[n].index % width;                                  \
+            int y = pending[n].index / width;                                  \
+            Point p = { work->origin.x + dx * x, work->origin.y - dy * y };    \
+            double_t zx, zy, cx, cy;                                           \
+            INIT;                                                              \
+                                                                               \
+            uint32_t i = pending[n].iterations;                                \
+            if (i > 0) {                                                       \
+                zx = pending[n].zx;                                            \
+                zy = pending[n].zy;                                            \
+            }                                                                  \
+                                                                               \
+            for (; i < max_iterations; i++) {                                  \
+                STEP;                                                          \
+                if (zx * zx + zy * zy >= 4.0) {                                \
+                    break;                                                     \
+                }                                                              \
+            }                                                                  \
+                                                                               \
+            pending[n].iterations = i;                                         \
+            pending[n].zx = zx;                                                \
+            pending[n].zy = zy;                                                \
+        }                                                                      \
+    }
+
+#define DEFINE_KERNEL(NAME, INIT, STEP)                                         \
+    DEFINE_SCALAR_KERNEL(NAME, INIT, STEP)                                     \
+    DEFINE_BATCHED_KERNEL(NAME, INIT, STEP)                                    \
+    DEFINE_FLOAT_KERNEL(NAME, INIT, STEP)                                      \
+    DEFINE_ORBIT_KERNEL(NAME, INIT, STEP)                                      \
+    DEFINE_RESUME_KERNEL(NAME, INIT, STEP)                                     \
+    static const KernelFunction kernel_##NAME[KERNEL_VARIANTS] = {             \
+        [VARIANT_SCALAR] = kernel_##NAME##_scalar,                             \
+        [VARIANT_BATCHED] = kernel_##NAME##_batched,                           \
+    };
+
+#define INIT_PARAMETER_PLANE \
+    zx = cx = p.x;           \
+    zy = cy = p.y
+
+#define INIT_DYNAMIC_PLANE \
+    zx = p.x;              \
+    zy = p.y;              \
+    cx = jx;               \
+    cy = jy
+
+#define STEP_SQUARE                                 \
+    do {                                            \
+        real_t t = zx * zx - zy * zy + cx;          \
+        zy = 2 * zx * zy + cy;                      \
+        zx = t;                                     \
+    } while (0)
+
+#define STEP_BURNING_SHIP                           \
+    do {                                            \
+        real_t ax = fabs(zx);                       \
+        real_t ay = fabs(zy);                       \
+        real_t t = ax * ax - ay * ay + cx;          \
+        zy = 2 * ax * ay + cy;                      \
+        zx = t;                                     \
+    } while (0)
+
+#define STEP_TRICORN                                \
+    do {                                            \
+        real_t t = zx * zx - zy * zy + cx;          \
+        zy = -2 * zx * zy + cy;                     \
+        zx = t;                                     \
+    } while (0)
+
+// N is a literal, so the power loop is fully unrolled
+#define STEP_POWER(N)                               \
+    do {                                            \
+        real_t px = zx;                             \
+        real_t py = zy;                             \
+        for (int k = 1; k < (N); k++) {             \
+            real_t t = px * zx - py * zy;           \
+            py = px * zy + py * zx;                 \
+            px = t;                                 \
+        }                                           \
+        zx = px + cx;                               \
+        zy = py + cy;                               \
+    } while (0)
+
+DEFINE_KERNEL(mandelbrot, INIT_PARAMETER_PLANE, STEP_SQUARE)
+DEFINE_KERNEL(julia, INIT_DYNAMIC_PLANE, STEP_SQUARE)
+DEFINE_KERNEL(burning_ship, INIT_PARAMETER_PLANE, STEP_BURNING_SHIP)
+DEFINE_KERNEL(tricorn, INIT_PARAMETER_PLANE, STEP_TRICORN)
+DEFINE_KERNEL(multibrot_3, INIT_PARAMETER_PLANE, STEP_POWER(3))
+DEFINE_KERNEL(multibrot_4, INIT_PARAMETER_PLANE, STEP_POWER(4))
+DEFINE_KERNEL(multibrot_5, INIT_PARAMETER_PLANE, STEP_POWER(5))
+DEFINE_KERNEL(multibrot_6, INIT_PARAMETER_PLANE, STEP_POWER(6))
+DEFINE_KERNEL(multibrot_7, INIT_PARAMETER_PLANE, STEP_POWER(7))
+DEFINE_KERNEL(multibrot_8, INIT_PARAMETER_PLANE, STEP_POWER(8))
+
+static const KernelFunction* multibrot_kernels[MAX_POWER + 1] = {
+    [2] = kernel_mandelbrot,
+    [3] = kernel_multibrot_3,
+    [4] = kernel_multibrot_4,
+    [5] = kernel_multibrot_5,
+    [6] = kernel_multibrot_6,
+    [7] = kernel_multibrot_7,
+    [8] = kernel_multibrot_8,
+};
+
+static const OrbitFunction multibrot_orbits[MAX_POWER + 1] = {
+    [2] = orbit_mandelbrot,
+    [3] = orbit_multibrot_3,
+    [4] = orbit_multibrot_4,
+    [5] = orbit_multibrot_5,
+    [6] = orbit_multibrot_6,
+    [7] = orbit_multibrot_7,
+    [8] = orbit_multibrot_8,
+};
+
+static const ResumeFunction multibrot_resumes[MAX_POWER + 1] = {
+    [2] = resume_mandelbrot,
+    [3] = resume_multibrot_3,
+    [4] = resume_multibrot_4,
+    [5] = resume_multibrot_5,
+    [6] = resume_multibrot_6,
+    [7] = resume_multibrot_7,
+    [8] = resume_multibrot_8,
+};
+
+KernelFunction select_kernel(const Kernel* kernel, KernelVariant variant)
+{
+    if (variant >= KERNEL_VARIANTS) {
+        return NULL;
+    }
+
+    switch (kernel->kind) {
+    case FRACTAL_MANDELBROT:
+        return kernel_mandelbrot[variant];
+    case FRACTAL_JULIA:
+        return kernel_julia[variant];
+    case FRACTAL_BURNING_SHIP:
+        return kernel_burning_ship[variant];
+    case FRACTAL_TRICORN:
+        return kernel_tricorn[variant];
+    case FRACTAL_MULTIBROT:
+        if (kernel->power >= MIN_POWER && kernel->power <= MAX_POWER) {
+            return multibrot_kernels[kernel->power][variant];
+        }
+        break;
+    }
+
+    return NULL;
+}
+
+OrbitFunction select_orbit(const Kernel* kernel)
+{
+    switch (kernel->kind) {
+    case FRACTAL_MANDELBROT:
+        return orbit_mandelbrot;
+    case FRACTAL_JULIA:
+        return orbit_julia;
+    case FRACTAL_BURNING_SHIP:
+        return orbit_burning_ship;
+    case FRACTAL_TRICORN:
+        return orbit_tricorn;
+    case FRACTAL_MULTIBROT:
+        if (kernel->power >= MIN_POWER && kernel->power <= MAX_POWER) {
+            return multibrot_orbits[kernel->power];
+        }
+        break;
+    }
+
+    return NULL;
+}
+
+ResumeFunction select_resume(const Kernel* kernel)
+{
+    switch (kernel->kind) {
+    case FRACTAL_MANDELBROT:
+        return resume_mandelbrot;
+    case FRACTAL_JULIA:
+        return resume_julia;
+    case FRACTAL_BURNING_SHIP:
+        return resume_burning_ship;
+    case FRACTAL_TRICORN:
+        return resume_tricorn;
+    case FRACTAL_MULTIBROT:
+        if (kernel->power >= MIN_POWER && kernel->power <= MAX_POWER) {
+            return multibrot_resumes[kernel->power];
+        }
+        break;
+    }
+
+    return NULL;
+}
+
+static const KernelFunction multibrot_floats[MAX_POWER + 1] = {
+    [2] = kernel_mandelbrot_float,
+    [3] = kernel_multibrot_3_float,
+    [4] = kernel_multibrot_4_float,
+    [5] = kernel_multibrot_5_float,
+    [6] = kernel_multibrot_6_float,
+    [7] = kernel_multibrot_7_float,
+    [8] = kernel_multibrot_8_float,
+};
+
+KernelFunction select_float_kernel(const Kernel* kernel)
+{
+    switch (kernel->kind) {
+    case FRACTAL_MANDELBROT:
+        return kernel_mandelbrot_float;
+    case FRACTAL_JULIA:
+        return kernel_julia_float;
+    case FRACTAL_BURNING_SHIP:
+        return kernel_burning_ship_float;
+    case FRACTAL_TRICORN:
+        return kernel_tricorn_float;
+    case FRACTAL_MULTIBROT:
+        if (kernel->power >= MIN_POWER && kernel->power <= MAX_POWER) {
+            return multibrot_floats[kernel->power];
+        }
+        break;
+    }
+
+    return NULL;
+}
+
+// True when neighbouring pixels of rows [first_row, end_row) stay well apart
+// in float, next to the largest value z, c or the pixel positions reach there
+int float_precision_safe(const WorkUnit* work, int first_row, int end_row)
+{
+    double top = work->origin.y - work->step.y * (int)(work->row_offset + first_row);
+    double bottom = work->origin.y - work->step.y * (int)(work->row_offset + end_row);
+    double right = work->origin.x + work->step.x * work->bound.width;
+    double magnitude = fmax(fmax(2.0, fmax(fabs(work->kernel.c.x), fabs(work->kernel.c.y))),
+        fmax(fmax(fabs(work->origin.x), fabs(right)), fmax(fabs(top), fabs(bottom))));
+
+    return fmin(work->step.x, work->step.y) > FLOAT_MIN_SPACING * FLT_EPSILON * magnitude;
+}
+
+static const char* variant_names[KERNEL_VARIANTS] = {
+    [VARIANT_SCALAR] = "scalar",
+    [VARIANT_BATCHED] = "batched",
+};
+
+int parse_kernel_variant(const char* name, KernelVariant* variant)
+{
+    for (int i = 0; i < KERNEL_VARIANTS; i++) {
+        if (strcmp(name, variant_names[i]) == 0) {
+            *variant = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+const char* kernel_variant_name(KernelVariant variant)
+{
+    return variant < KERNEL_VARIANTS ? variant_names[variant] : "unknown";
+}
+
+void default_tuning(Tuning* tuning)
+{
+    tuning->tile_rows = TILE_ROWS;
+    tuning->threads = 1;
+    tuning->variant = VARIANT_SCALAR;
+}
+
+uint32_t count_tiles(const WorkUnit* work, const Tuning* tuning)
+{
+    int tile_rows = tuning->tile_rows > 0 ? tuning->tile_rows : TILE_ROWS;
+
+    return (work->bound.height + tile_rows - 1) / tile_rows;
+}
+
+// Zeroes a buffer of size rows with the thread-to-tile mapping render_work()
+// uses, so each tile's pages are first touched (and placed on the NUMA node
+// of) the thread that will render it. Used for the iteration buffer and the
+// pixel buffers it is coloured into.
+void touch_rows(void* buffer, Bound size, size_t element_size, const Tuning* tuning)
+{
+    int tile_rows = tuning->tile_rows > 0 ? tuning->tile_rows : TILE_ROWS;
+    int tiles = (size.height + tile_rows - 1) / tile_rows;
+    int threads = tuning->threads > 0 ? tuning->threads : 1;
+    size_t row_length = (size_t)size.width * element_size;
+
+#pragma omp parallel for schedule(static, 1) num_threads(threads)
+    for (int tile = 0; tile < tiles; tile++) {
+        int first_row = tile * tile_rows;
+        int end_row = first_row + tile_rows < size.height ? first_row + tile_rows : size.height;
+
+        memset((uint8_t*)buffer + first_row * row_length, 0, (end_row - first_row) * row_length);
+    }
+}
+
+// mirrored rows are skipped here and copied from their source rows later
+static void render_rows(KernelFunction kernel, const WorkUnit* work, int first_row, int end_row, uint32_t* iterations)
+{
+    for (int row = first_row; row < end_row;) {
+        int run = row;
+        while (run < end_row && mirror_row(work, work->row_offset + run) < 0) {
+            run++;
+        }
+
+        if (run > row) {
+            kernel(work, row, run, iterations);
+        }
+
+        row = run + 1;
+    }
+}
+
+/*
+ * Renders FLOAT_PROBES pixels of a float tile again in double, spread over
+ * its rows and, by the golden ratio, over its columns. A probe differs
+ * visibly when its count is off by more than one level of a 256 level
+ * palette.
+ */
+static int float_tile_agrees(const WorkUnit* work, int first_row, int end_row, const uint32_t* iterations)
+{
+    ResumeFunction resume = select_resume(&work->kernel);
+    PendingPixel probes[FLOAT_PROBES];
+    int local[FLOAT_PROBES];
+    int width = work->bound.width;
+    int count = 0;
+
+    for (int k = 0; k < FLOAT_PROBES; k++) {
+        int y = first_row + (k * (end_row - first_row)) / FLOAT_PROBES;
+        int x = width * fmod(k * 0.6180339887498949, 1.0);
+        uint32_t row = work->row_offset + y;
+
+        if (mirror_row(work, row) >= 0 || reused_pixel(work, x, row)) {
+            continue;
+        }
+
+        probes[count].zx = 0.0;
+        probes[count].zy = 0.0;
+        probes[count].index = (uint64_t)row * width + x;
+        probes[count].iterations = 0;
+        local[count] = bound_index(x, y, work->bound);
+        count++;
+    }
+
+    resume(work, width, probes, 0, count, work->kernel.max_iterations);
+
+    // one palette level, at least one iteration even when levels outnumber iterations
+    uint32_t tolerance = (work->kernel.max_iterations + 255) / 256;
+    int mismatches = 0;
+    for (int n = 0; n < count; n++) {
+        uint32_t single = iterations[local[n]];
+        uint32_t full = probes[n].iterations;
+
+        mismatches += (single > full ? single - full : full - single) > tolerance;
+    }
+
+    return mismatches <= FLOAT_MAX_MISMATCHES;
+}
+
+// Returns how many tiles of a float WorkUnit had to be rendered in double
+uint32_t render_work(const WorkUnit* work, uint32_t* iterations, const Tuning* tuning, Progress* progress)
+{
+    KernelFunction kernel = select_kernel(&work->kernel, tuning->variant);
+    KernelFunction preview = work->precision == PRECISION_FLOAT ? select_float_kernel(&work->kernel) : NULL;
+    assert(kernel != NULL);
+
+    int tile_rows = tuning->tile_rows > 0 ? tuning->tile_rows : TILE_ROWS;
+    int tiles = count_tiles(work, tuning);
+    int threads = tuning->threads > 0 ? tuning->threads : 1;
+    uint32_t promoted = 0;
+
+    // tiles are written straight into their slice of the band, no staging copy;
+    // round-robin assignment keeps neighbouring (similar cost) tiles on different threads
+#pragma omp parallel for schedule(static, 1) num_threads(threads) reduction(+ : promoted)
+    for (int tile = 0; tile < tiles; tile++) {
+        int first_row = tile * tile_rows;
+        int end_row = first_row + tile_rows < work->bound.height ? first_row + tile_rows : work->bound.height;
+
+        if (preview && float_precision_safe(work, first_row, end_row)) {
+            render_rows(preview, work, first_row, end_row, iterations);
+            if (!float_tile_agrees(work, first_row, end_row, iterations)) {
+                render_rows(kernel, work, first_row, end_row, iterations);
+                promoted++;
+            }
+        } else {
+            render_rows(kernel, work, first_row, end_row, iterations);
+            promoted += preview != NULL;
+        }
+
+        if (progress) {
+            progress_add(progress, end_row - first_row);
+        }
+    }
+
+    return promoted;
+}
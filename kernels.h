@@ -0,0 +1,91 @@
+#ifndef _KERNELS_H_
+#define _KERNELS_H_
+
+#include "mpi_test.h"
+#include "progress.h"
+
+// Multibrot powers with a compiled kernel
+#define MIN_POWER 2
+#define MAX_POWER 8
+
+// Bands are rendered in tiles of this many rows unless tuned otherwise
+#define TILE_ROWS 16
+
+// Pixels iterated together by the batched kernels
+#define KERNEL_LANES 4
+
+// Pixels iterated together by the float kernels, twice as many fit a vector
+#define FLOAT_LANES (2 * KERNEL_LANES)
+
+// A WorkUnit or tile is only rendered in float when its pixels are at least
+// this many float epsilons of its largest coordinate apart
+#define FLOAT_MIN_SPACING 16
+
+// Pixels of each float tile that are rendered again in double, and how many
+// of them may differ visibly before the whole tile is rendered in double
+#define FLOAT_PROBES 64
+#define FLOAT_MAX_MISMATCHES 2
+
+typedef enum Precision {
+    PRECISION_DOUBLE,
+    PRECISION_FLOAT, // preview quality, tiles are promoted to double where it shows
+} Precision;
+
+typedef enum KernelVariant {
+    VARIANT_SCALAR,
+    VARIANT_BATCHED,
+    KERNEL_VARIANTS,
+} KernelVariant;
+
+// Per-rank execution settings, the same on every rank of a host
+typedef struct Tuning {
+    uint32_t tile_rows;
+    uint32_t threads;
+    uint32_t variant;
+} Tuning;
+
+// Renders the iteration counts of rows [first_row, end_row) of a WorkUnit into
+// iterations, which holds the whole WorkUnit (bound_length(work->bound) entries,
+// row major).
+typedef void (*KernelFunction)(const WorkUnit* work, int first_row, int end_row, uint32_t* iterations);
+
+// Iterates the point p and stores the z values it visits in orbit (room for
+// kernel->max_iterations points). Returns how many were stored if p escapes,
+// zero if it is still bounded at the iteration limit.
+typedef uint32_t (*OrbitFunction)(const Kernel* kernel, Point p, Point* orbit);
+
+// A pixel whose orbit is carried over between iteration limits. index is the
+// row major pixel index in the whole image; z is only meaningful once
+// iterations is non-zero.
+typedef struct PendingPixel {
+    double zx;
+    double zy;
+    uint64_t index;
+    uint32_t iterations;
+} PendingPixel;
+
+// Continues pending[first, end) from their saved state up to max_iterations.
+// Escaped pixels are left with iterations below the limit.
+typedef void (*ResumeFunction)(const WorkUnit* work, uint32_t width, PendingPixel* pending, int first, int end, uint32_t max_iterations);
+
+int parse_fractal_kind(const char* name, FractalKind* kind);
+const char* fractal_kind_name(FractalKind kind);
+
+void make_kernel(Kernel* kernel, FractalKind kind, int power, Point c, int max_iterations);
+void default_view(const Kernel* kernel, Point* center, RectSize* size);
+int kernel_is_mirrored(const Kernel* kernel);
+
+KernelFunction select_kernel(const Kernel* kernel, KernelVariant variant);
+OrbitFunction select_orbit(const Kernel* kernel);
+ResumeFunction select_resume(const Kernel* kernel);
+KernelFunction select_float_kernel(const Kernel* kernel);
+int float_precision_safe(const WorkUnit* work, int first_row, int end_row);
+int parse_kernel_variant(const char* name, KernelVariant* variant);
+const char* kernel_variant_name(KernelVariant variant);
+
+void default_tuning(Tuning* tuning);
+uint32_t count_tiles(const WorkUnit* work, const Tuning* tuning);
+void touch_rows(void* buffer, Bound size, size_t element_size, const Tuning* tuning);
+uint32_t render_work(const WorkUnit* work, uint32_t* iterations, const Tuning* tuning, Progress* progress);
+
+#endif
@@ -1,166 +1,711 @@
 #include <assert.h>
-#include <complex.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include <magick/api.h>
 #include <mpi.h>
 
+#include "affinity.h"
 #include "argparse.h"
+#include "atlas.h"
+#include "bench.h"
+#include "colour.h"
+#include "density.h"
+#include "image_io.h"
+#include "kernels.h"
 #include "mpi_test.h"
+#include "partition.h"
+#include "png_encode.h"
+#include "pool.h"
+#include "progress.h"
+#include "pyramid.h"
+#include "refine.h"
+#include "tune.h"
+#include "video.h"
+#include "writer.h"
+#include "zoom.h"
 
 const int WIDTH = 1024;
 const int HEIGHT = 768;
 
-void write_image(Pixel* pixels, int width, int height, const char* filename)
+#define DEFAULT_OUTPUT "test_image.png"
+
+// What a run does, decided by root and broadcast before anything else
+typedef enum RunMode {
+    RUN_RENDER,
+    RUN_BENCH, // time MPI transfers only
+    RUN_ATLAS, // many small Julia sets, each whole on one rank
+} RunMode;
+
+uint32_t* generate_band(WorkUnit band, Bound img_geometry, int rank, const Tuning* tuning, Progress* progress, BufferPool* pool, uint32_t* promoted)
 {
-    ExceptionInfo exception;
-    char geometry[MaxTextExtent];
+    uint32_t* iterations = pool_get(pool, bound_length(band.bound) * sizeof(uint32_t));
+
+    touch_rows(iterations, band.bound, sizeof(uint32_t), tuning);
+    progress_start(progress, band.bound.height, img_geometry);
+    *promoted = render_work(&band, iterations, tuning, progress);
+    progress_finish(progress);
 
-    InitializeMagick(NULL);
+    return iterations;
+}
+
+uint32_t* density_band(WorkUnit band, Bound img_geometry, const Tuning* tuning, BufferPool* pool, MPI_Comm comm)
+{
+    uint32_t* levels = pool_get(pool, bound_length(band.bound) * sizeof(uint32_t));
+
+    render_density(&band, img_geometry, levels, tuning, comm);
+
+    return levels;
+}
+
+// Where the earlier stages of a refined frame are written, see write_refine_stage()
+typedef struct StagePreview {
+    const char* file_name;
+    const FrameHistory* history;
+    const Tuning* tuning;
+    MPI_Datatype pixel_type;
+} StagePreview;
+
+/*
+ * Collective: colours the counts of a refine stage with a palette of the
+ * stage's limit and writes them to the frame's name numbered by stage, e.g.
+ * out_0000.png, so the picture can be watched sharpening while the deeper
+ * stages run. The last stage goes to the frame's own name as usual. PNG and
+ * Deep Zoom previews are written by every rank, other formats are gathered
+ * on root; a video only gets finished frames.
+ */
+void write_refine_stage(const WorkUnit* work, Bound img, uint32_t* iterations, int stage, uint32_t limit, void* context, MPI_Comm comm)
+{
+    const StagePreview* preview = context;
+    ImageFormat format = image_format(preview->file_name);
 
-    ImageInfo* image_info = CloneImageInfo(0);
-    GetExceptionInfo(&exception);
-    Image* image = ConstituteImage(width, height, "RGB", CharPixel, pixels, &exception);
-    if (image == NULL) {
-        CatchException(&exception);
-        DestroyMagick();
+    if (format == FORMAT_Y4M) {
         return;
     }
 
-    snprintf(geometry, MaxTextExtent, "%dx%d", width, height);
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    // rows refine skips are filled in now and again once the last stage is done
+    fill_reused_pixels(work, iterations, preview->history, comm);
+    fill_mirrored_rows(work, iterations, comm);
+
+    WorkUnit palette = *work;
+    palette.kernel.max_iterations = limit;
+    int count = bound_length(work->bound);
+
+    BufferPool pool;
+    pool_init(&pool);
+    pool_reserve(&pool, pool_size(count * sizeof(uint32_t)) + pool_size(count * sizeof(Pixel)) + colour_buffer_size(&palette)
+        + (format == FORMAT_PNG ? png_band_buffer_size(work->bound) : 0));
+
+    // carried over pixels were counted to the last limit
+    uint32_t* capped = pool_get(&pool, count * sizeof(uint32_t));
+    for (int i = 0; i < count; i++) {
+        capped[i] = iterations[i] < limit ? iterations[i] : limit;
+    }
+
+    Pixel* pixels = pool_get(&pool, count * sizeof(Pixel));
+    colour_band(&palette, capped, pixels, preview->tuning, &pool, comm);
+
+    char name[OUTPUT_NAME_MAX];
+    frame_file_name(name, preview->file_name, stage, MAX_REFINE_STAGES);
+
+    if (format == FORMAT_PNG) {
+        EncodedBand encoded;
+        if (encode_png_band(&encoded, pixels, work->bound, rank == 0, rank == ranks - 1, &pool) != 0) {
+            printf("Worker %d: PNG encoding failed\n", rank);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        write_png_bands(&encoded, img, name, NULL, NULL, work->output == OUTPUT_PARALLEL, comm);
+    } else if (format == FORMAT_DZI) {
+        write_pyramid(pixels, work, img, name, comm);
+    } else {
+        int offset = work->row_offset * img.width;
+        int* counts = rank == 0 ? malloc(2 * ranks * sizeof(int)) : NULL;
+        Pixel* image = rank == 0 ? malloc(bound_length(img) * sizeof(Pixel)) : NULL;
+
+        MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+        MPI_Gather(&offset, 1, MPI_INT, rank == 0 ? counts + ranks : NULL, 1, MPI_INT, 0, comm);
+        MPI_Gatherv(pixels, count, preview->pixel_type, image, counts, rank == 0 ? counts + ranks : NULL, preview->pixel_type, 0, comm);
+        if (rank == 0) {
+            write_image(image, img, name, NULL, NULL);
+        }
+
+        free(counts);
+        free(image);
+    }
+
+    if (rank == 0) {
+        printf("Refine stage %d preview written to %s\n", stage + 1, name);
+    }
 
-    image_info->size = geometry;
-    strncpy(image->filename, filename, MaxTextExtent);
-    if (!WriteImage(image_info, image)) {
-        CatchException(&exception);
-        DestroyImage(image);
-        DestroyMagick();
+    pool_free(&pool);
+}
+
+uint32_t* refined_band(WorkUnit band, Bound img_geometry, const Tuning* tuning, BufferPool* pool, const StagePreview* stages, MPI_Comm comm)
+{
+    uint32_t* iterations = pool_get(pool, bound_length(band.bound) * sizeof(uint32_t));
+
+    refine_band(&band, img_geometry, iterations, tuning, write_refine_stage, (void*)stages, comm);
+
+    return iterations;
+}
+
+// promoted is set to the number of float tiles that were rendered in double
+uint32_t* render_band(WorkUnit band, Bound img_geometry, int rank, const Tuning* tuning, Progress* progress, BufferPool* pool, uint32_t* promoted, const StagePreview* stages, MPI_Comm comm)
+{
+    *promoted = 0;
+
+    if (band.render == RENDER_DENSITY) {
+        return density_band(band, img_geometry, tuning, pool, comm);
+    } else if (band.refine[0] > 0) {
+        return refined_band(band, img_geometry, tuning, pool, stages, comm);
+    }
+
+    return generate_band(band, img_geometry, rank, tuning, progress, pool, promoted);
+}
+
+// Collective: root gets a description of the precision the frame was rendered in
+void describe_precision(const WorkUnit* work, const Tuning* tuning, uint32_t promoted, char* text, MPI_Comm comm)
+{
+    uint32_t tiles[3] = {
+        count_tiles(work, tuning),
+        work->precision == PRECISION_FLOAT ? count_tiles(work, tuning) - promoted : 0,
+        promoted,
+    };
+    uint32_t total[3];
+
+    MPI_Reduce(tiles, total, 3, MPI_UINT32_T, MPI_SUM, 0, comm);
+    if (text == NULL) {
         return;
     }
+
+    if (total[1] + total[2] == 0) {
+        snprintf(text, PRECISION_TEXT_MAX, "double");
+    } else {
+        snprintf(text, PRECISION_TEXT_MAX, "float32 preview, %u of %u tiles in float, %u promoted to double",
+            total[1], total[0], total[2]);
+    }
 }
 
-int escapes(Point p)
+// the WorkUnit whose iteration limit sizes and indexes the palette
+WorkUnit palette_work(WorkUnit band)
 {
-    complex double z0, z;
+    WorkUnit palette = band;
 
-    z0 = p.x + p.y * I;
-    z = z0;
+    if (band.render == RENDER_DENSITY) {
+        density_palette_work(&palette, &band);
+    }
 
-    int i;
-    for (i = 0; i < 255; i++) {
-        z = z * z + z0;
-        if (cabs(z) >= 2.0) {
-            break;
-        }
+    return palette;
+}
+
+size_t band_buffer_size(WorkUnit band)
+{
+    WorkUnit palette = palette_work(band);
+
+    return pool_size(bound_length(band.bound) * sizeof(uint32_t)) + colour_buffer_size(&palette);
+}
+
+// the pixels a band is coloured into, placed like its iterations
+Pixel* band_pixel_buffer(WorkUnit work, const Tuning* tuning, BufferPool* pool)
+{
+    Pixel* pixels = pool_get(pool, bound_length(work.bound) * sizeof(Pixel));
+
+    touch_rows(pixels, work.bound, sizeof(Pixel), tuning);
+    return pixels;
+}
+
+// RGB formats are coloured straight into the mapped output file, anything
+// else goes through a pool buffer and is converted by close_band_output()
+Pixel* open_band_output(MappedImage* image, WorkUnit work, Bound img_geometry, const char* file_name, const Tuning* tuning, BufferPool* pool)
+{
+    ImageFormat format = image_format(file_name);
+
+    if (map_image(image, file_name, format, img_geometry, work.row_offset, work.bound.height, 0) != 0) {
+        MPI_Abort(MPI_COMM_WORLD, 1);
     }
 
-    return i;
+    if (format_pixel_size(format) == sizeof(Pixel)) {
+        return (Pixel*)image->pixels;
+    }
+
+    return band_pixel_buffer(work, tuning, pool);
 }
 
-Pixel* generate_band(WorkUnit band, int rank)
+void close_band_output(MappedImage* image, WorkUnit work, const Pixel* pixels, const char* file_name)
 {
-    Pixel* pixels = malloc(bound_length(band.bound) * sizeof(Pixel));
-    printf("Worker %d: allocated %zu bytes\n", rank, bound_length(band.bound) * sizeof(Pixel));
+    if (image->pixels) {
+        store_pixels(image->pixels, pixels, bound_length(work.bound), image_format(file_name));
+    }
 
-    for (int y = 0; y < band.bound.height; y++) {
-        for (int x = 0; x < band.bound.width; x++) {
-            Point p = map_coord_to_point(x, y, band);
+    unmap_image(image);
+}
 
-            int c = escapes(p);
-            int i = bound_index(x, y, band.bound);
+// Collective: every rank deflates its own band and only compressed bytes are
+// gathered (or, in parallel mode, written by each rank at its own offset)
+void encode_band(WorkUnit work, const Pixel* pixels, Bound img_geometry, const char* file_name, const char* precision, BufferPool* pool, int rank, int world_size, MPI_Comm comm)
+{
+    EncodedBand encoded;
 
-            pixels[i].red = c;
-            pixels[i].green = c;
-            pixels[i].blue = c;
+    double start = MPI_Wtime();
+    if (encode_png_band(&encoded, pixels, work.bound, rank == 0, rank == world_size - 1, pool) != 0) {
+        printf("Worker %d: PNG encoding failed\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    double elapsed = MPI_Wtime() - start, slowest;
+
+    MPI_Reduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    printf("Worker %d: band encoded, %llu bytes\n", rank, (unsigned long long)encoded.length);
+
+    write_png_bands(&encoded, img_geometry, file_name, "Precision", precision, work.output == OUTPUT_PARALLEL, comm);
+    if (rank == 0) {
+        printf("PNG encode took %.3fs on the slowest rank\n", slowest);
+    }
+}
+
+/*
+ * Collective: every rank converts its coloured band to YUV and root gathers
+ * the planes straight into the next free frame of the stream. Bands start on
+ * even rows, so each rank's chroma rows are whole. A full queue holds root
+ * here until the reader catches up.
+ */
+void stream_band(WorkUnit work, const Pixel* pixels, Bound img_geometry, const WorkUnit* bands, VideoStream* video, BufferPool* pool, int world_size, MPI_Comm comm)
+{
+    size_t luma = bound_length(work.bound);
+    size_t chroma = chroma_width(work.bound) * chroma_rows(work.bound.height);
+    uint8_t* yuv = pool_get(pool, yuv_band_size(work.bound));
+    rgb_to_yuv420(pixels, work.bound, yuv, yuv + luma, yuv + luma + chroma);
+
+    uint8_t* frame = NULL;
+    int* counts = NULL;
+    int* displs = NULL;
+    if (video != NULL) {
+        frame = video_next_frame(video);
+        counts = malloc(world_size * sizeof(int));
+        displs = malloc(world_size * sizeof(int));
+    }
+
+    size_t plane_offset[3] = { 0, luma, luma + chroma };
+    size_t frame_offset[3] = { 0, bound_length(img_geometry), bound_length(img_geometry) + chroma_width(img_geometry) * chroma_rows(img_geometry.height) };
+
+    for (int plane = 0; plane < 3; plane++) {
+        for (int zone = 0; video != NULL && zone < world_size; zone++) {
+            if (plane == 0) {
+                counts[zone] = bound_length(bands[zone].bound);
+                displs[zone] = bands[zone].row_offset * img_geometry.width;
+            } else {
+                counts[zone] = chroma_width(img_geometry) * chroma_rows(bands[zone].bound.height);
+                displs[zone] = chroma_width(img_geometry) * (bands[zone].row_offset / 2);
+            }
         }
+
+        MPI_Gatherv(yuv + plane_offset[plane], plane == 0 ? luma : chroma, MPI_BYTE,
+            frame + frame_offset[plane], counts, displs, MPI_BYTE, 0, comm);
     }
 
-    return pixels;
+    if (video != NULL) {
+        video_queue_frame(video);
+        free(counts);
+        free(displs);
+    }
 }
 
-void worker(Local_MPI_Types* types, int rank)
+void worker(Local_MPI_Types* types, int rank, BufferPool* pool, MPI_Comm comm, int writers)
 {
     WorkUnit work;
-    MPI_Status status;
+    Bound img_geometry;
+    uint32_t frames;
+    char file_name[OUTPUT_NAME_MAX];
+    MappedImage image;
+    Pixel* pixels;
+    Tuning tuning;
+    WorkUnit sample;
+
+    Progress progress;
+    FrameHistory history;
+    WriterLink link;
+
+    writer_link_init(&link, writers, MPI_COMM_WORLD);
+    establish_tuning(&tuning, &sample, NULL, 0, types->workunit_type, comm);
+    place_threads(&tuning, 0, comm);
+    progress_init(&progress, 0.0, NULL, comm);
+    frame_history_init(&history);
+
+    MPI_Bcast(&img_geometry, 1, types->bound_type, 0, comm);
+    MPI_Bcast(&frames, 1, MPI_UINT32_T, 0, comm);
+
+    int world_size;
+    MPI_Comm_size(comm, &world_size);
+
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        MPI_Bcast(file_name, OUTPUT_NAME_MAX, MPI_CHAR, 0, comm);
+        MPI_Scatter(NULL, 1, types->workunit_type, &work, 1, types->workunit_type, 0, comm);
+
+        printf("Worker %d Recieved work unit:", rank);
+        printf_workunit(work);
+
+        ImageFormat format = image_format(file_name);
+
+        pool_reset(pool);
+        if (writers > 0) {
+            // the band buffer is taken from the link once the band is rendered
+            pool_reserve(pool, band_buffer_size(work));
+            pixels = NULL;
+        } else if (format == FORMAT_PNG) {
+            pool_reserve(pool, band_buffer_size(work) + pool_size(bound_length(work.bound) * sizeof(Pixel)) + png_band_buffer_size(work.bound));
+            pixels = band_pixel_buffer(work, &tuning, pool);
+        } else if (format == FORMAT_DZI) {
+            pool_reserve(pool, band_buffer_size(work) + pool_size(bound_length(work.bound) * sizeof(Pixel)));
+            pixels = band_pixel_buffer(work, &tuning, pool);
+        } else if (format == FORMAT_Y4M) {
+            pool_reserve(pool, band_buffer_size(work) + pool_size(bound_length(work.bound) * sizeof(Pixel)) + pool_size(yuv_band_size(work.bound)));
+            pixels = band_pixel_buffer(work, &tuning, pool);
+        } else if (work.output == OUTPUT_PARALLEL) {
+            pool_reserve(pool, band_buffer_size(work) + pool_size(bound_length(work.bound) * sizeof(Pixel)));
+            pixels = open_band_output(&image, work, img_geometry, file_name, &tuning, pool);
+        } else {
+            pool_reserve(pool, band_buffer_size(work) + pool_size(bound_length(work.bound) * sizeof(Pixel)));
+            pixels = band_pixel_buffer(work, &tuning, pool);
+        }
 
-    MPI_Scatter(NULL, 1, types->workunit_type, &work, 1, types->workunit_type, 0, MPI_COMM_WORLD);
+        double start = MPI_Wtime();
+        uint32_t promoted;
+        StagePreview stages = { file_name, &history, &tuning, types->pixel_type };
+        uint32_t* iterations = render_band(work, img_geometry, rank, &tuning, &progress, pool, &promoted, &stages, comm);
+        double elapsed = MPI_Wtime() - start;
+        printf("Worker %d:Done generating band\n", rank);
+        describe_precision(&work, &tuning, promoted, NULL, comm);
+
+        fill_reused_pixels(&work, iterations, &history, comm);
+        fill_mirrored_rows(&work, iterations, comm);
+        if (frame + 1 < frames) {
+            frame_history_keep(&history, &work, iterations);
+        }
 
-    printf("Worker %d Recieved work unit:", rank);
-    printf_workunit(work);
+        if (writers > 0) {
+            pixels = writer_band(&link, frame, bound_length(work.bound));
+        }
 
-    Pixel* pixels = generate_band(work, rank);
-    printf("Worker %d:Done generating band\n", rank);
+        WorkUnit palette = palette_work(work);
+        colour_band(&palette, iterations, pixels, &tuning, pool, comm);
+
+        MPI_Gather(&elapsed, 1, MPI_DOUBLE, NULL, 1, MPI_DOUBLE, 0, comm);
+        if (writers > 0) {
+            send_band(&link, frame, &work, types->pixel_type);
+            printf("Worker %d: band sent to writer\n", rank);
+        } else if (format == FORMAT_PNG) {
+            encode_band(work, pixels, img_geometry, file_name, NULL, pool, rank, world_size, comm);
+        } else if (format == FORMAT_DZI) {
+            write_pyramid(pixels, &work, img_geometry, file_name, comm);
+        } else if (format == FORMAT_Y4M) {
+            stream_band(work, pixels, img_geometry, NULL, NULL, pool, world_size, comm);
+        } else if (work.output == OUTPUT_PARALLEL) {
+            close_band_output(&image, work, pixels, file_name);
+            MPI_Barrier(comm);
+            printf("Worker %d: results written\n", rank);
+        } else {
+            MPI_Gatherv(pixels, bound_length(work.bound), types->pixel_type, NULL, NULL, NULL, types->pixel_type, 0, comm);
+            printf("Worker %d: results sent\n", rank);
+        }
+    }
 
-    MPI_Gather(pixels, bound_length(work.bound), types->pixel_type, NULL, bound_length(work.bound), types->pixel_type, 0, MPI_COMM_WORLD);
+    writer_link_close(&link, 0);
+    report_pool_usage(pool, comm);
+    frame_history_free(&history);
+    progress_free(&progress);
+    return;
+}
 
-    printf("Worker %d: results sent\n", rank);
+// A single image keeps the requested view as it is; the frames of a zoom
+// sequence are snapped to a grid that halves exactly from frame to frame.
+Rect frame_view(ZoomFrame* zoom, Point center, RectSize size, Bound img_geometry, uint32_t frame, uint32_t frames)
+{
+    Rect r;
 
-    free(pixels);
-    return;
+    zoom_frame(zoom, center, size, img_geometry, frame);
+    if (frames > 1) {
+        return zoom->view;
+    }
+
+    make_rect(&r, center, size);
+    return r;
 }
 
-void master(Local_MPI_Types* types, int world_size, const Bound img_geometry, const char* file_name)
+void master(Local_MPI_Types* types, int world_size, Bound img_geometry, const Kernel* kernel, Point center, RectSize size, uint32_t frames, int fps, int reuse, int preview, PartitionMode partition, RenderMode render, uint32_t samples, const uint32_t* refine, Colouring colouring, OutputMode output, const Tuning* requested, int autotune, int bind, double progress_interval, const char* status_file, BufferPool* pool, const char* file_name, MPI_Comm comm, int writers)
 {
     int zones = world_size;
+    ZoomFrame zoom, previous;
+    Rect r = frame_view(&zoom, center, size, img_geometry, 0, frames);
 
-    printf("Allocating %zu for pixel array\n", bound_length(img_geometry) * sizeof(Pixel));
-    Pixel* pixels = malloc(bound_length(img_geometry) * sizeof(Pixel));
-    Rect r;
+    Tuning tuning;
+    WorkUnit sample;
+    make_calibration_work(&sample, r, img_geometry, kernel);
+    establish_tuning(&tuning, &sample, requested, autotune, types->workunit_type, comm);
+    place_threads(&tuning, bind, comm);
+
+    Progress progress;
+    progress_init(&progress, progress_interval, status_file, comm);
 
-    Point origin = { -0.5, 0.0 };
-    RectSize rsize = { 2.5, 2.5 };
+    FrameHistory history;
+    frame_history_init(&history);
 
-    make_rect(&r, origin, rsize);
+    WriterLink link;
+    writer_link_init(&link, writers, MPI_COMM_WORLD);
 
     WorkUnit* bands = malloc(sizeof(WorkUnit) * zones);
-    for (int zone = 0; zone < zones; zone++) {
-        bands[zone].bound.width = img_geometry.width;
-        bands[zone].bound.height = (img_geometry.height / zones);
-        bands[zone].region.ul.x = r.ul.x;
-        bands[zone].region.ul.y = r.ul.y - ((rsize.height / zones) * zone);
-        bands[zone].region.lr.x = r.lr.x;
-        bands[zone].region.lr.y = r.ul.y - ((rsize.height / zones) * ((zone + 1)));
+    double* estimate = malloc(sizeof(double) * zones);
+    double* measured = malloc(sizeof(double) * zones);
+    int* counts = malloc(sizeof(int) * zones);
+    int* displs = malloc(sizeof(int) * zones);
+    if (partition == PARTITION_COST && render == RENDER_DENSITY) {
+        // orbits land anywhere in the image, so escape time cost says nothing about a band
+        printf("Density rendering samples the whole image on every rank, using equal bands\n");
+        partition = PARTITION_EQUAL;
     }
 
-    for (int i = 0; i < zones; i++) {
-        printf_workunit(bands[i]);
+    if (reuse && preview) {
+        // float counts are not exact, so they must not be carried into the next frame
+        printf("Float previews are not reused between frames, rendering every frame in full\n");
+        reuse = 0;
     }
 
-    WorkUnit work;
-    MPI_Scatter(bands, 1, types->workunit_type, &work, 1, types->workunit_type, 0, MPI_COMM_WORLD);
+    if (reuse && render == RENDER_DENSITY) {
+        // every pixel's density gathers orbits from the whole view, which changes with every frame
+        printf("Orbit density frames share no samples, rendering every frame in full\n");
+        reuse = 0;
+    }
 
-    printf("Root node:\n");
-    printf_workunit(work);
+    ImageFormat format = image_format(file_name);
+    MappedImage image;
+    if (output == OUTPUT_PARALLEL && !native_format(format) && format != FORMAT_PNG && format != FORMAT_DZI) {
+        printf("Parallel output needs a .raw, .pgm, .ppm or .png file, gathering on root instead\n");
+        output = OUTPUT_GATHER;
+    }
+
+    // opening a FIFO waits for its reader, before any rank starts rendering
+    VideoStream video;
+    if (format == FORMAT_Y4M && video_open(&video, file_name, img_geometry, fps) != 0) {
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
 
-    Pixel* band_pixels = generate_band(work, 0);
-    printf("Worker %d:Done generating band\n", 0);
+    MPI_Bcast(&img_geometry, 1, types->bound_type, 0, comm);
+    MPI_Bcast(&frames, 1, MPI_UINT32_T, 0, comm);
 
-    MPI_Gather(band_pixels, bound_length(work.bound), types->pixel_type,
-        pixels, bound_length(work.bound), types->pixel_type, 0, MPI_COMM_WORLD);
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        previous = zoom;
+        r = frame_view(&zoom, center, size, img_geometry, frame, frames);
 
-    printf("Worker %d: results sent\n", 0);
+        // copied pixels of the whole image: mirrored rows and samples shared with the previous frame
+        WorkUnit copied = { .reuse = 0 };
 
-    write_image(pixels, img_geometry.width, img_geometry.height, file_name);
+        // orbit density covers the whole image from every band, there is nothing to mirror
+        copied.mirror = render == RENDER_ESCAPE ? align_mirror(&r, img_geometry, kernel) : 0;
+        if (reuse && frame > 0 && !zoom_reuse(&copied, &previous, &zoom, img_geometry)) {
+            printf("Frame %u: no exact 2x zoom from the previous frame, rendering it in full\n", frame);
+        }
+
+        if (copied.mirror > 0 || copied.reuse) {
+            uint64_t rendered = 0;
+            int mirrored = 0;
+
+            make_band(&copied, r, img_geometry, 0, img_geometry.height);
+            for (int y = 0; y < img_geometry.height; y++) {
+                int first;
+                if (mirror_row(&copied, y) >= 0) {
+                    mirrored++;
+                } else {
+                    rendered += rendered_columns(&copied, y, &first);
+                }
+            }
+
+            if (copied.mirror > 0) {
+                printf("View is mirrored across the real axis, %d of %d rows are copied\n", mirrored, img_geometry.height);
+            }
+            printf("Frame %u: rendering %llu of %llu pixels\n", frame, (unsigned long long)rendered, (unsigned long long)bound_length(img_geometry));
+        }
+
+        if (partition == PARTITION_COST) {
+            double start = MPI_Wtime();
+            partition_cost(bands, estimate, zones, r, img_geometry, kernel, &tuning, &copied);
+            printf("Cost pre-pass took %.3fs\n", MPI_Wtime() - start);
+        } else {
+            partition_equal(bands, estimate, zones, r, img_geometry, &copied);
+        }
+
+        if (format == FORMAT_Y4M) {
+            // chroma is subsampled over row pairs, which must not be split between ranks
+            even_band_rows(bands, zones, r, img_geometry);
+        }
+
+        char name[OUTPUT_NAME_MAX];
+        frame_file_name(name, file_name, frame, frames);
+
+        if (output == OUTPUT_PARALLEL && native_format(format)) {
+            // size the file and write its header before any rank maps it
+            if (map_image(&image, name, format, img_geometry, 0, 0, 1) != 0) {
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            unmap_image(&image);
+        }
 
-    if (band_pixels) {
-        free(band_pixels);
+        for (int zone = 0; zone < zones; zone++) {
+            bands[zone].kernel = *kernel;
+            bands[zone].colouring = colouring;
+            bands[zone].output = output;
+            bands[zone].render = render;
+            bands[zone].samples = samples;
+            bands[zone].mirror = copied.mirror;
+            bands[zone].reuse = copied.reuse;
+            bands[zone].reuse_x = copied.reuse_x;
+            bands[zone].reuse_y = copied.reuse_y;
+            memcpy(bands[zone].refine, refine, sizeof(bands[zone].refine));
+
+            // previews of shallow bands run in float, refined and density renders stay in double
+            int single = preview && render == RENDER_ESCAPE && refine[0] == 0
+                && float_precision_safe(&bands[zone], 0, bands[zone].bound.height);
+            bands[zone].precision = single ? PRECISION_FLOAT : PRECISION_DOUBLE;
+        }
+
+        for (int zone = 0; zone < zones; zone++) {
+            counts[zone] = bound_length(bands[zone].bound);
+            displs[zone] = bands[zone].row_offset * img_geometry.width;
+        }
+
+        for (int i = 0; i < zones; i++) {
+            printf_workunit(bands[i]);
+        }
+
+        MPI_Bcast(name, OUTPUT_NAME_MAX, MPI_CHAR, 0, comm);
+
+        WorkUnit work;
+        MPI_Scatter(bands, 1, types->workunit_type, &work, 1, types->workunit_type, 0, comm);
+
+        printf("Root node:\n");
+        printf_workunit(work);
+
+        pool_reset(pool);
+        Pixel* pixels = NULL;
+        Pixel* band_pixels;
+        if (writers > 0) {
+            // the frame's writer rank assembles and writes it while the next one renders
+            pool_reserve(pool, band_buffer_size(work));
+            band_pixels = NULL;
+        } else if (format == FORMAT_PNG) {
+            // each rank encodes its own band, root never holds the whole image
+            pool_reserve(pool, band_buffer_size(work) + pool_size(bound_length(work.bound) * sizeof(Pixel)) + png_band_buffer_size(work.bound));
+            band_pixels = band_pixel_buffer(work, &tuning, pool);
+        } else if (format == FORMAT_DZI) {
+            // each rank tiles its own rows, root never holds the whole image
+            pool_reserve(pool, band_buffer_size(work) + pool_size(bound_length(work.bound) * sizeof(Pixel)));
+            band_pixels = band_pixel_buffer(work, &tuning, pool);
+        } else if (format == FORMAT_Y4M) {
+            // each rank converts its own band, root only assembles YUV frames
+            pool_reserve(pool, band_buffer_size(work) + pool_size(bound_length(work.bound) * sizeof(Pixel)) + pool_size(yuv_band_size(work.bound)));
+            band_pixels = band_pixel_buffer(work, &tuning, pool);
+        } else if (output == OUTPUT_PARALLEL) {
+            pool_reserve(pool, band_buffer_size(work) + pool_size(bound_length(work.bound) * sizeof(Pixel)));
+            band_pixels = open_band_output(&image, work, img_geometry, name, &tuning, pool);
+        } else if (native_format(format) && format_pixel_size(format) == sizeof(Pixel)) {
+            // gather straight into the mapped output file, root's band included
+            pool_reserve(pool, band_buffer_size(work));
+            if (map_image(&image, name, format, img_geometry, 0, img_geometry.height, 1) != 0) {
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            pixels = (Pixel*)image.pixels;
+            band_pixels = pixels + work.row_offset * img_geometry.width;
+        } else {
+            // root colours its band straight into its slice of the image and gathers in place
+            printf("Allocating %zu for pixel array\n", bound_length(img_geometry) * sizeof(Pixel));
+            pool_reserve(pool, pool_size(bound_length(img_geometry) * sizeof(Pixel)) + band_buffer_size(work));
+            pixels = pool_get(pool, bound_length(img_geometry) * sizeof(Pixel));
+            touch_rows(pixels, img_geometry, sizeof(Pixel), &tuning);
+            band_pixels = pixels + work.row_offset * img_geometry.width;
+        }
+
+        double start = MPI_Wtime();
+        uint32_t promoted;
+        StagePreview stages = { name, &history, &tuning, types->pixel_type };
+        uint32_t* iterations = render_band(work, img_geometry, 0, &tuning, &progress, pool, &promoted, &stages, comm);
+        double elapsed = MPI_Wtime() - start;
+        progress_collect(&progress);
+        printf("Worker %d:Done generating band\n", 0);
+
+        char precision[PRECISION_TEXT_MAX];
+        describe_precision(&work, &tuning, promoted, precision, comm);
+        printf("Frame %u precision: %s\n", frame, precision);
+
+        fill_reused_pixels(&work, iterations, &history, comm);
+        fill_mirrored_rows(&work, iterations, comm);
+        if (frame + 1 < frames) {
+            frame_history_keep(&history, &work, iterations);
+        }
+
+        if (writers > 0) {
+            band_pixels = writer_band(&link, frame, bound_length(work.bound));
+        }
+
+        WorkUnit palette = palette_work(work);
+        colour_band(&palette, iterations, band_pixels, &tuning, pool, comm);
+
+        MPI_Gather(&elapsed, 1, MPI_DOUBLE, measured, 1, MPI_DOUBLE, 0, comm);
+
+        if (writers > 0) {
+            send_frame_header(&link, frame, name, precision, img_geometry, bands);
+            send_band(&link, frame, &work, types->pixel_type);
+            printf("Frame %u handed to writer rank %d\n", frame, zones + frame % writers);
+        } else if (format == FORMAT_PNG) {
+            encode_band(work, band_pixels, img_geometry, name, precision, pool, 0, zones, comm);
+        } else if (format == FORMAT_DZI) {
+            write_pyramid(band_pixels, &work, img_geometry, name, comm);
+        } else if (format == FORMAT_Y4M) {
+            stream_band(work, band_pixels, img_geometry, bands, &video, pool, zones, comm);
+        } else if (output == OUTPUT_PARALLEL) {
+            close_band_output(&image, work, band_pixels, name);
+            MPI_Barrier(comm);
+            printf("Worker %d: results written\n", 0);
+        } else {
+            MPI_Gatherv(MPI_IN_PLACE, bound_length(work.bound), types->pixel_type,
+                pixels, counts, displs, types->pixel_type, 0, comm);
+
+            printf("Worker %d: results sent\n", 0);
+
+            if (native_format(format) && format_pixel_size(format) == sizeof(Pixel)) {
+                unmap_image(&image);
+            } else {
+                write_image(pixels, img_geometry, name, "Precision", precision);
+            }
+        }
+
+        report_imbalance(bands, estimate, measured, zones);
     }
 
-    if (pixels) {
-        free(pixels);
+    if (format == FORMAT_Y4M) {
+        video_close(&video);
     }
 
+    writer_link_close(&link, 1);
+
+    report_pool_usage(pool, comm);
+    frame_history_free(&history);
+    progress_free(&progress);
+
     if (bands) {
         free(bands);
     }
+
+    free(estimate);
+    free(measured);
+    free(counts);
+    free(displs);
 }
 
 static const char* usage[] = {
-    "mpi_test [-x <width>] [-y <height>]",
+    "mpi_test [-x <width>] [-y <height>] [-p <equal|cost>] [-k <kernel>] [-n <power>] [-j <re,im>] [-i <iterations>] [-c <linear|histogram>] [-m <escape|density>] [-s <samples>] [--refine <limit,limit,...>] [--center <re,im>] [--frames <count>] [--fps <rate>] [--reuse] [--preview] [-o <file>] [-w <gather|parallel>] [-a] [-t <threads>] [--tile-rows <rows>] [--variant <scalar|batched>] [--bind] [--progress <seconds>] [--status <file>] [--writers <ranks>] [--bench] [--atlas <columns>x<rows>] [--atlas-files]",
     NULL
 };
 
@@ -168,6 +713,20 @@ int main(int argc, const char** argv)
 {
     int rank, size;
     const char* file_name = NULL;
+    const char* partition_name = NULL;
+    const char* kernel_name = NULL;
+    const char* julia_param = NULL;
+    const char* colouring_name = NULL;
+    const char* output_name = NULL;
+    const char* variant_name = NULL;
+    const char* status_file = NULL;
+    const char* render_name = NULL;
+    const char* refine_list = NULL;
+    const char* center_param = NULL;
+    const char* atlas_param = NULL;
+    int threading;
+
+    claim_stdout_stream(argc, argv);
 
 #ifdef USE_HDF5
     printf("Using HDF5\n");
@@ -181,7 +740,8 @@ int main(int argc, const char** argv)
     printf("(HSV) %Lf, %Lf, %Lf\n", (long double)p_1.h, (long double)p_1.s, (long double)p_1.v);
     printf("(RGB) %X, %X, %X\n", p_2.red, p_2.green, p_2.blue);
 
-    if (MPI_Init(NULL, NULL) != MPI_SUCCESS) {
+    // render threads stay off MPI; progress updates are funneled through the main thread
+    if (MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &threading) != MPI_SUCCESS) {
         printf("Unable to init MPI\n");
         return -1;
     }
@@ -192,17 +752,75 @@ int main(int argc, const char** argv)
     Local_MPI_Types types;
     make_mpi_types(&types);
 
+    BufferPool pool;
+    pool_init(&pool);
+
+    // every rank learns from root whether this run renders, only times transfers or renders an atlas,
+    // and how many of the last ranks only write frames
+    int mode = RUN_RENDER, writers = 0;
+    MPI_Comm compute = MPI_COMM_WORLD;
+
     if (rank != 0) {
-        worker(&types, rank);
+        int run[2];
+        MPI_Bcast(run, 2, MPI_INT, 0, MPI_COMM_WORLD);
+        mode = run[0];
+        writers = run[1];
+        if (writers > 0) {
+            compute = split_writers(writers, MPI_COMM_WORLD);
+        }
+
+        if (mode == RUN_BENCH) {
+            run_comm_benchmark(&types, (Bound) { 0, 0 }, MPI_COMM_WORLD);
+        } else if (mode == RUN_ATLAS) {
+            Atlas atlas;
+            char file_name[OUTPUT_NAME_MAX];
+            run_atlas(&types, &atlas, file_name, NULL, 0, 0, &pool, MPI_COMM_WORLD);
+        } else if (compute == MPI_COMM_NULL) {
+            serve_writes(&types, writers, MPI_COMM_WORLD);
+        } else {
+            worker(&types, rank, &pool, compute, writers);
+        }
     } else {
         // master
         int width = WIDTH, height = HEIGHT;
+        int power = 2, max_iterations = MAX_ITERATIONS;
+        int autotune = 0, threads = 0, tile_rows = 0, bind = 0;
+        int samples = DENSITY_SAMPLES;
+        int frames = 1, fps = VIDEO_DEFAULT_FPS, reuse = 0, preview = 0;
+        int bench = 0, atlas_files = 0, writer_ranks = 0;
+        float progress_interval = PROGRESS_INTERVAL;
 
         struct argparse_option options[] = {
             OPT_HELP(),
             OPT_INTEGER('x', "width", &width, "image width"),
             OPT_INTEGER('y', "height", &height, "image height"),
-            OPT_STRING('o', "output", &file_name, "output file name"),
+            OPT_STRING('o', "output", &file_name, "output file name (.raw, .pgm, .ppm, .png, .dzi tile pyramid, .y4m video, - for video on stdout or any GraphicsMagick format)"),
+            OPT_STRING('w', "write", &output_name, "output mode: gather on root or parallel write by every rank"),
+            OPT_STRING('p', "partition", &partition_name, "band partitioning: equal or cost"),
+            OPT_STRING('k', "kernel", &kernel_name, "mandelbrot, julia, multibrot, burning-ship or tricorn"),
+            OPT_INTEGER('n', "power", &power, "multibrot power (2-8)"),
+            OPT_STRING('j', "julia", &julia_param, "julia parameter c as re,im"),
+            OPT_INTEGER('i', "iterations", &max_iterations, "iteration limit"),
+            OPT_STRING(0, "refine", &refine_list, "render in stages of rising iteration limits, e.g. 255,1000,10000"),
+            OPT_STRING(0, "center", &center_param, "view center as re,im"),
+            OPT_INTEGER(0, "frames", &frames, "render a sequence of frames, each zoomed 2x into the center"),
+            OPT_INTEGER(0, "fps", &fps, "frame rate recorded in a .y4m video"),
+            OPT_BOOLEAN(0, "reuse", &reuse, "carry samples shared with the previous frame over instead of rendering them"),
+            OPT_BOOLEAN(0, "preview", &preview, "render shallow views in float, tiles that differ visibly are redone in double"),
+            OPT_STRING('c', "colour", &colouring_name, "colouring: linear or histogram"),
+            OPT_STRING('m', "mode", &render_name, "render mode: escape time or orbit density"),
+            OPT_INTEGER('s', "samples", &samples, "orbit density samples per pixel"),
+            OPT_BOOLEAN('a', "autotune", &autotune, "calibrate tile size, threads and kernel variant and save them for this host"),
+            OPT_INTEGER('t', "threads", &threads, "threads per rank (overrides tuning)"),
+            OPT_INTEGER(0, "tile-rows", &tile_rows, "rows per tile (overrides tuning)"),
+            OPT_STRING(0, "variant", &variant_name, "kernel variant: scalar or batched (overrides tuning)"),
+            OPT_BOOLEAN(0, "bind", &bind, "pin each rank's render threads to its share of the node's cores"),
+            OPT_FLOAT(0, "progress", &progress_interval, "seconds between progress updates, 0 to disable"),
+            OPT_STRING(0, "status", &status_file, "file rewritten with per-rank progress at every update"),
+            OPT_INTEGER(0, "writers", &writer_ranks, "reserve the last ranks to assemble and write frames while the others render"),
+            OPT_BOOLEAN(0, "bench", &bench, "skip rendering and time the image's transfers for each MPI strategy"),
+            OPT_STRING(0, "atlas", &atlas_param, "render a <columns>x<rows> grid of -x by -y Julia sets, c spanning the Mandelbrot view"),
+            OPT_BOOLEAN(0, "atlas-files", &atlas_files, "write every atlas image to its own numbered file instead of one mosaic"),
             OPT_END()
         };
 
@@ -217,16 +835,176 @@ int main(int argc, const char** argv)
             height = HEIGHT;
 
         if (file_name == NULL) {
-            file_name = "test_image.png";
+            file_name = DEFAULT_OUTPUT;
+        }
+
+        PartitionMode partition;
+        if (parse_partition_mode(partition_name, &partition) != 0) {
+            printf("Unknown partition mode '%s', using equal bands\n", partition_name);
+            partition = PARTITION_EQUAL;
+        }
+
+        FractalKind kind;
+        if (parse_fractal_kind(kernel_name, &kind) != 0) {
+            printf("Unknown kernel '%s', using mandelbrot\n", kernel_name);
+            kind = FRACTAL_MANDELBROT;
+        }
+
+        if (kind == FRACTAL_MULTIBROT && (power < MIN_POWER || power > MAX_POWER)) {
+            printf("Multibrot power must be between %d and %d, using 2\n", MIN_POWER, MAX_POWER);
+            power = 2;
+        }
+
+        Point c = { -0.8, 0.156 };
+        if (julia_param != NULL && sscanf(julia_param, "%lf,%lf", &c.x, &c.y) != 2) {
+            printf("Could not parse julia parameter '%s'\n", julia_param);
+        }
+
+        if (max_iterations <= 0)
+            max_iterations = MAX_ITERATIONS;
+
+        // the last stage is the iteration limit of the finished image
+        uint32_t refine[MAX_REFINE_STAGES] = { 0 };
+        if (refine_list != NULL) {
+            if (parse_refine_stages(refine_list, refine) != 0) {
+                printf("Could not parse refine stages '%s', rendering in one pass\n", refine_list);
+                memset(refine, 0, sizeof(refine));
+            } else {
+                for (int stage = 0; stage < MAX_REFINE_STAGES && refine[stage] > 0; stage++) {
+                    max_iterations = refine[stage];
+                }
+            }
+        }
+
+        Kernel kernel;
+        make_kernel(&kernel, kind, power, c, max_iterations);
+        printf("kernel: %s, %d iterations\n", fractal_kind_name(kernel.kind), kernel.max_iterations);
+
+        Point center;
+        RectSize view_size;
+        default_view(&kernel, &center, &view_size);
+        if (center_param != NULL && sscanf(center_param, "%lf,%lf", &center.x, &center.y) != 2) {
+            printf("Could not parse view center '%s'\n", center_param);
+            default_view(&kernel, &center, &view_size);
+        }
+
+        if (frames <= 0)
+            frames = 1;
+        if (fps <= 0)
+            fps = VIDEO_DEFAULT_FPS;
+
+        Colouring colouring;
+        if (parse_colouring(colouring_name, &colouring) != 0) {
+            printf("Unknown colouring '%s', using linear\n", colouring_name);
+            colouring = COLOUR_LINEAR;
+        }
+
+        RenderMode render;
+        if (parse_render_mode(render_name, &render) != 0) {
+            printf("Unknown render mode '%s', using escape time\n", render_name);
+            render = RENDER_ESCAPE;
+        }
+
+        if (samples <= 0)
+            samples = DENSITY_SAMPLES;
+
+        OutputMode output;
+        if (parse_output_mode(output_name, &output) != 0) {
+            printf("Unknown output mode '%s', gathering on root\n", output_name);
+            output = OUTPUT_GATHER;
+        }
+
+        // zero fields are left to the tuning file or the calibration
+        Tuning requested = { 0, 0, KERNEL_VARIANTS };
+        requested.tile_rows = tile_rows > 0 ? tile_rows : 0;
+        requested.threads = threads > 0 ? threads : 0;
+
+        KernelVariant variant;
+        if (variant_name != NULL) {
+            if (parse_kernel_variant(variant_name, &variant) == 0) {
+                requested.variant = variant;
+            } else {
+                printf("Unknown kernel variant '%s', using the tuned one\n", variant_name);
+            }
+        }
+
+        if (threading < MPI_THREAD_FUNNELED && progress_interval > 0.0f) {
+            printf("MPI library is not thread safe, no live progress from multithreaded renders\n");
         }
 
         Bound img_geometry = { width, height };
 
         printf("output: %s  (%d x %d)\n", file_name, width, height);
 
-        master(&types, size, img_geometry, file_name);
+        Bound atlas_grid;
+        if (atlas_param != NULL && parse_atlas_grid(atlas_param, &atlas_grid) != 0) {
+            printf("Could not parse atlas grid '%s', rendering a single image\n", atlas_param);
+            atlas_param = NULL;
+        }
+
+        ImageFormat format = image_format(file_name);
+        if (atlas_param != NULL && (format == FORMAT_DZI || format == FORMAT_Y4M)) {
+            printf("Atlas images are written as plain images, using %s\n", DEFAULT_OUTPUT);
+            file_name = DEFAULT_OUTPUT;
+        }
+
+        mode = bench ? RUN_BENCH : (atlas_param != NULL ? RUN_ATLAS : RUN_RENDER);
+        writers = writer_ranks;
+        if (writers > 0 && mode != RUN_RENDER) {
+            printf("Writer ranks only write rendered frames, not reserving any\n");
+            writers = 0;
+        } else if (writers > 0 && (format == FORMAT_DZI || format == FORMAT_Y4M)) {
+            // pyramids are written by every rank and video by root's writer thread already
+            printf("Writer ranks write whole images, not %s, not reserving any\n", format == FORMAT_DZI ? "tile pyramids" : "video streams");
+            writers = 0;
+        } else if (writers >= size) {
+            printf("%d writer ranks would leave no rank to render, not reserving any\n", writers);
+            writers = 0;
+        } else if (writers < 0) {
+            writers = 0;
+        }
+
+        if (writers > 0 && output == OUTPUT_PARALLEL) {
+            printf("Writer ranks assemble whole frames, not writing in parallel\n");
+            output = OUTPUT_GATHER;
+        }
+
+        int run[2] = { mode, writers };
+        MPI_Bcast(run, 2, MPI_INT, 0, MPI_COMM_WORLD);
+        if (writers > 0) {
+            compute = split_writers(writers, MPI_COMM_WORLD);
+            printf("Ranks %d to %d only write frames\n", size - writers, size - 1);
+        }
+
+        if (mode == RUN_BENCH) {
+            run_comm_benchmark(&types, img_geometry, MPI_COMM_WORLD);
+        } else if (mode == RUN_ATLAS) {
+            Atlas atlas;
+            char atlas_name[OUTPUT_NAME_MAX];
+            RectSize unused;
+
+            // the grid spans the Mandelbrot set's view, recentred by --center
+            Kernel mandelbrot;
+            make_kernel(&mandelbrot, FRACTAL_MANDELBROT, 2, c, max_iterations);
+            if (center_param == NULL) {
+                default_view(&mandelbrot, &center, &unused);
+            }
+
+            snprintf(atlas_name, OUTPUT_NAME_MAX, "%s", file_name);
+            make_atlas(&atlas, atlas_grid, img_geometry, center, max_iterations, colouring, atlas_files);
+            run_atlas(&types, &atlas, atlas_name, &requested, autotune, bind, &pool, MPI_COMM_WORLD);
+        } else {
+            master(&types, size - writers, img_geometry, &kernel, center, view_size, frames, fps, reuse, preview, partition, render, samples, refine, colouring, output, &requested, autotune, bind, progress_interval, status_file, &pool, file_name, compute, writers);
+        }
     }
 
+    if (compute != MPI_COMM_WORLD && compute != MPI_COMM_NULL) {
+        MPI_Comm_free(&compute);
+    }
+
+    pool_free(&pool);
+    shutdown_image_io();
+
     MPI_Finalize();
     return 0;
 }
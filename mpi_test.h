@@ -53,12 +53,51 @@ typedef struct Rect {
 
 void make_mpi_type_Rect(MPI_Datatype* type, MPI_Datatype point_type);
 
+typedef enum FractalKind {
+    FRACTAL_MANDELBROT,
+    FRACTAL_JULIA,
+    FRACTAL_MULTIBROT,
+    FRACTAL_BURNING_SHIP,
+    FRACTAL_TRICORN,
+} FractalKind;
+
+// Formula selection travels with every WorkUnit; power only applies to Multibrot
+// and c only to Julia.
+typedef struct Kernel {
+    uint32_t kind;
+    uint32_t power;
+    uint32_t max_iterations;
+    Point c;
+} Kernel;
+
+void make_mpi_type_Kernel(MPI_Datatype* type, MPI_Datatype point_type);
+
+// Iteration limits of a progressive render, zero terminated
+#define MAX_REFINE_STAGES 8
+
+// Pixel (x, y) of a WorkUnit sits at origin + step * (x, row_offset + y), with
+// origin and step taken from the whole view, so every banding of an image
+// samples exactly the same points. region is the band's own extent.
 typedef struct WorkUnit {
     Bound bound;
     Rect region;
+    Point origin;
+    Point step;
+    uint32_t row_offset;
+    uint32_t colouring;
+    uint32_t output;
+    uint32_t render;
+    uint32_t samples; // orbit density samples per image pixel
+    uint32_t mirror; // sum of a row and its mirror image row, zero for no mirroring
+    uint32_t reuse; // non-zero when samples are carried over from the previous frame
+    uint32_t precision;
+    uint32_t refine[MAX_REFINE_STAGES];
+    int32_t reuse_x; // pixel (x, y) with x + reuse_x and y + reuse_y both even
+    int32_t reuse_y; // is previous frame pixel ((x + reuse_x) / 2, (y + reuse_y) / 2)
+    Kernel kernel;
 } WorkUnit;
 
-void make_mpi_type_WorkUnit(MPI_Datatype* type, MPI_Datatype bound_type, MPI_Datatype rect_type);
+void make_mpi_type_WorkUnit(MPI_Datatype* type, MPI_Datatype bound_type, MPI_Datatype rect_type, MPI_Datatype point_type, MPI_Datatype kernel_type);
 
 typedef struct Local_MPI_Types {
     MPI_Datatype pixel_type;
@@ -66,6 +105,7 @@ typedef struct Local_MPI_Types {
     MPI_Datatype point_type;
     MPI_Datatype rect_type;
     MPI_Datatype rectsize_type;
+    MPI_Datatype kernel_type;
     MPI_Datatype workunit_type;
 } Local_MPI_Types;
 
@@ -80,6 +120,12 @@ double_t rect_width(Rect r);
 double_t rect_height(Rect r);
 
 Point map_coord_to_point(int x, int y, WorkUnit w);
+int mirror_row(const WorkUnit* w, int row);
+int reuse_row(const WorkUnit* w, int row);
+int reused_pixel(const WorkUnit* w, int x, int row);
+int rendered_columns(const WorkUnit* w, int row, int* first);
+
+#define MAX_ITERATIONS 255
 
 #define printf_point(p) printf("(%Lf,%Lf)", (long double) p.x, (long double) p.y);
 #define printf_region(r) \
@@ -179,19 +179,47 @@ void make_mpi_type_Rect(MPI_Datatype* type, MPI_Datatype point_type)
     MPI_Type_commit(type);
 }
 
-void make_mpi_type_WorkUnit(MPI_Datatype* type, MPI_Datatype bound_type, MPI_Datatype rect_type)
+void make_mpi_type_Kernel(MPI_Datatype* type, MPI_Datatype point_type)
 {
-    int blocklengths[] = { 1, 1 };
+    int blocklengths[] = { 3, 1 };
+    MPI_Aint displacements[] = {
+        offsetof(Kernel, kind),
+        offsetof(Kernel, c),
+    };
+    MPI_Datatype datatypes[] = {
+        MPI_UINT32_T,
+        point_type,
+    };
+
+    MPI_Type_create_struct(2, blocklengths, displacements, datatypes, type);
+    MPI_Type_commit(type);
+}
+
+void make_mpi_type_WorkUnit(MPI_Datatype* type, MPI_Datatype bound_type, MPI_Datatype rect_type, MPI_Datatype point_type, MPI_Datatype kernel_type)
+{
+    int blocklengths[] = { 1, 1, 2, 8 + MAX_REFINE_STAGES, 2, 1 };
     MPI_Aint displacements[] = {
         offsetof(WorkUnit, bound),
         offsetof(WorkUnit, region),
+        offsetof(WorkUnit, origin),
+        offsetof(WorkUnit, row_offset),
+        offsetof(WorkUnit, reuse_x),
+        offsetof(WorkUnit, kernel),
     };
     MPI_Datatype datatypes[] = {
         bound_type,
         rect_type,
+        point_type,
+        MPI_UINT32_T,
+        MPI_INT32_T,
+        kernel_type,
     };
+    MPI_Datatype packed;
 
-    MPI_Type_create_struct(2, blocklengths, displacements, datatypes, type);
+    // trailing padding must be part of the extent so arrays of WorkUnits scatter correctly
+    MPI_Type_create_struct(6, blocklengths, displacements, datatypes, &packed);
+    MPI_Type_create_resized(packed, 0, sizeof(WorkUnit), type);
+    MPI_Type_free(&packed);
     MPI_Type_commit(type);
 }
 
@@ -202,7 +230,8 @@ void make_mpi_types(Local_MPI_Types* types)
     make_mpi_type_Point(&types->point_type);
     make_mpi_type_Rect(&types->rect_type, types->point_type);
     make_mpi_type_RectSize(&types->rectsize_type);
-    make_mpi_type_WorkUnit(&types->workunit_type, types->bound_type, types->rect_type);
+    make_mpi_type_Kernel(&types->kernel_type, types->point_type);
+    make_mpi_type_WorkUnit(&types->workunit_type, types->bound_type, types->rect_type, types->point_type, types->kernel_type);
 }
 
 int bound_index(int x, int y, Bound size)
@@ -247,13 +276,55 @@ Point map_coord_to_point(int x, int y, WorkUnit w)
 {
     Point p;
 
-    RectSize rs;
+    p.x = w.origin.x + w.step.x * x;
+    p.y = w.origin.y - w.step.y * (int)(w.row_offset + y);
+
+    return p;
+}
+
+/*
+ * Returns the image row whose pixels are the mirror image of image row row
+ * across the real axis, or -1 when row has to be rendered. Only rows below
+ * the axis whose y is exactly the negation of a row above it qualify, so a
+ * copied row is bit for bit what rendering it would give.
+ */
+int mirror_row(const WorkUnit* w, int row)
+{
+    if (w->mirror == 0) {
+        return -1;
+    }
 
-    double_t x_offset = (rect_width(w.region) / w.bound.width) * x;
-    double_t y_offset = (rect_height(w.region) / w.bound.height) * y;
+    int source = (int)w->mirror - row;
+    if (source < 0 || source >= row) {
+        return -1;
+    }
 
-    p.x = w.region.ul.x + x_offset;
-    p.y = w.region.ul.y - y_offset;
+    double_t y = w->origin.y - w->step.y * row;
+    double_t source_y = w->origin.y - w->step.y * source;
 
-    return p;
+    return y < 0.0 && source_y == -y ? source : -1;
+}
+
+// Rows of the image with samples carried over from the previous frame
+int reuse_row(const WorkUnit* w, int row)
+{
+    return w->reuse && ((row + w->reuse_y) & 1) == 0;
+}
+
+int reused_pixel(const WorkUnit* w, int x, int row)
+{
+    return reuse_row(w, row) && ((x + w->reuse_x) & 1) == 0;
+}
+
+// Number of columns of an image row that are rendered, every other one
+// from *first in rows that reuse the previous frame
+int rendered_columns(const WorkUnit* w, int row, int* first)
+{
+    if (!reuse_row(w, row)) {
+        *first = 0;
+        return w->bound.width;
+    }
+
+    *first = (w->reuse_x + 1) & 1;
+    return (w->bound.width - *first + 1) / 2;
 }
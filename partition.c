@@ -0,0 +1,327 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "partition.h"
+
+int parse_partition_mode(const char* name, PartitionMode* mode)
+{
+    if (name == NULL || strcmp(name, "equal") == 0) {
+        *mode = PARTITION_EQUAL;
+    } else if (strcmp(name, "cost") == 0) {
+        *mode = PARTITION_COST;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+void make_band(WorkUnit* band, Rect view, Bound img, int first_row, int end_row)
+{
+    band->origin = view.ul;
+    band->step.x = rect_width(view) / img.width;
+    band->step.y = rect_height(view) / img.height;
+
+    band->bound.width = img.width;
+    band->bound.height = end_row - first_row;
+    band->row_offset = first_row;
+    band->region.ul.x = view.ul.x;
+    band->region.ul.y = view.ul.y - (band->step.y * first_row);
+    band->region.lr.x = view.lr.x;
+    band->region.lr.y = view.ul.y - (band->step.y * end_row);
+}
+
+/*
+ * For a kernel symmetric across the real axis and a view straddling it,
+ * nudges the view by under a quarter pixel and rounds its row step to
+ * MIRROR_STEP_BITS so that origin - step * row is computed exactly. Rows
+ * either side of the axis then have exactly negated y and are mirror images
+ * of each other. Returns the WorkUnit mirror value, or zero when nothing
+ * can be mirrored.
+ */
+uint32_t align_mirror(Rect* view, Bound img, const Kernel* kernel)
+{
+    if (!kernel_is_mirrored(kernel) || img.height >= MIRROR_MAX_ROWS || !(view->ul.y > 0.0 && view->lr.y < 0.0)) {
+        return 0;
+    }
+
+    int exponent;
+    double mantissa = frexp(rect_height(*view) / img.height, &exponent);
+    double step = ldexp(nearbyint(ldexp(mantissa, MIRROR_STEP_BITS)), exponent - MIRROR_STEP_BITS);
+
+    // row + mirror row is the same for every pair
+    double sum = nearbyint(2.0 * view->ul.y / step);
+    view->ul.y = step * sum / 2.0;
+    view->lr.y = view->ul.y - step * img.height;
+
+    WorkUnit whole;
+    make_band(&whole, *view, img, 0, img.height);
+    whole.mirror = sum;
+
+    for (int y = 0; y < img.height; y++) {
+        if (mirror_row(&whole, y) >= 0) {
+            return whole.mirror;
+        }
+    }
+
+    return 0;
+}
+
+int band_of_row(const uint32_t* first_rows, int ranks, int row)
+{
+    int band = 0;
+    while (band < ranks - 1 && (int)first_rows[band + 1] <= row) {
+        band++;
+    }
+
+    return band;
+}
+
+/*
+ * Collective: copies the iteration counts of every mirrored row of the band
+ * from the rank that rendered its source row. Both sides work out the same
+ * list of rows from the band layout, so only the counts themselves travel.
+ */
+void fill_mirrored_rows(const WorkUnit* work, uint32_t* iterations, MPI_Comm comm)
+{
+    if (work->mirror == 0) {
+        return;
+    }
+
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    uint32_t first_row = work->row_offset;
+    uint32_t* first_rows = malloc(ranks * sizeof(uint32_t));
+    uint32_t* end_rows = malloc(ranks * sizeof(uint32_t));
+    uint32_t end_row = first_row + work->bound.height;
+    MPI_Allgather(&first_row, 1, MPI_UINT32_T, first_rows, 1, MPI_UINT32_T, comm);
+    MPI_Allgather(&end_row, 1, MPI_UINT32_T, end_rows, 1, MPI_UINT32_T, comm);
+
+    int width = work->bound.width;
+    int* send_counts = calloc(ranks, sizeof(int));
+    int* send_displs = calloc(ranks, sizeof(int));
+    int* recv_counts = calloc(ranks, sizeof(int));
+    int* recv_displs = calloc(ranks, sizeof(int));
+
+    for (int r = 0; r < ranks; r++) {
+        for (uint32_t row = first_rows[r]; row < end_rows[r]; row++) {
+            int source = mirror_row(work, row);
+            if (source < 0) {
+                continue;
+            }
+
+            if (r == rank) {
+                recv_counts[band_of_row(first_rows, ranks, source)] += width;
+            }
+            if (band_of_row(first_rows, ranks, source) == rank) {
+                send_counts[r] += width;
+            }
+        }
+    }
+
+    for (int r = 1; r < ranks; r++) {
+        send_displs[r] = send_displs[r - 1] + send_counts[r - 1];
+        recv_displs[r] = recv_displs[r - 1] + recv_counts[r - 1];
+    }
+
+    uint32_t* send = malloc(((size_t)send_displs[ranks - 1] + send_counts[ranks - 1] + 1) * sizeof(uint32_t));
+    uint32_t* recv = malloc(((size_t)recv_displs[ranks - 1] + recv_counts[ranks - 1] + 1) * sizeof(uint32_t));
+
+    // rows go out in the order of the destination band, one run per rank
+    uint32_t* cursor = send;
+    for (int r = 0; r < ranks; r++) {
+        for (uint32_t row = first_rows[r]; row < end_rows[r]; row++) {
+            int source = mirror_row(work, row);
+            if (source >= 0 && band_of_row(first_rows, ranks, source) == rank) {
+                memcpy(cursor, iterations + (size_t)(source - first_row) * width, width * sizeof(uint32_t));
+                cursor += width;
+            }
+        }
+    }
+
+    MPI_Alltoallv(send, send_counts, send_displs, MPI_UINT32_T, recv, recv_counts, recv_displs, MPI_UINT32_T, comm);
+
+    for (int r = 0; r < ranks; r++) {
+        const uint32_t* row_data = recv + recv_displs[r];
+        for (uint32_t row = first_row; row < end_row; row++) {
+            int source = mirror_row(work, row);
+            if (source >= 0 && band_of_row(first_rows, ranks, source) == r) {
+                memcpy(iterations + (size_t)(row - first_row) * width, row_data, width * sizeof(uint32_t));
+                row_data += width;
+            }
+        }
+    }
+
+    free(send);
+    free(recv);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+    free(first_rows);
+    free(end_rows);
+}
+
+double* estimate_row_costs(Rect view, Bound img, const Kernel* kernel, const Tuning* tuning)
+{
+    Bound coarse;
+    make_bound(&coarse,
+        img.width > PREPASS_FACTOR ? img.width / PREPASS_FACTOR : 1,
+        img.height > PREPASS_FACTOR ? img.height / PREPASS_FACTOR : 1);
+
+    WorkUnit preview = { .kernel = *kernel };
+    make_band(&preview, view, coarse, 0, coarse.height);
+    uint32_t cap = kernel->max_iterations < PREPASS_ITERATIONS ? kernel->max_iterations : PREPASS_ITERATIONS;
+    preview.kernel.max_iterations = cap;
+
+    uint32_t* iterations = malloc(bound_length(coarse) * sizeof(uint32_t));
+    render_work(&preview, iterations, tuning, NULL);
+
+    double* coarse_cost = calloc(coarse.height, sizeof(double));
+    for (int y = 0; y < coarse.height; y++) {
+        for (int x = 0; x < coarse.width; x++) {
+            uint32_t i = iterations[bound_index(x, y, coarse)];
+
+            // points still bounded at the cap are most likely interior and will run to the full limit
+            coarse_cost[y] += (i >= cap) ? kernel->max_iterations : i + 1;
+        }
+    }
+    free(iterations);
+
+    double* row_cost = malloc(img.height * sizeof(double));
+    double scale = (double)img.width / coarse.width;
+    for (int y = 0; y < img.height; y++) {
+        row_cost[y] = coarse_cost[((uint64_t)y * coarse.height) / img.height] * scale;
+    }
+
+    free(coarse_cost);
+    return row_cost;
+}
+
+// a row joins the band while at least half of its cost falls below the cut
+static void cut_bands(WorkUnit* bands, double* estimate, int zones, Rect view, Bound img, const double* row_cost)
+{
+    double total = 0.0;
+    for (int y = 0; y < img.height; y++) {
+        total += row_cost[y];
+    }
+
+    int row = 0;
+    double done = 0.0;
+    for (int zone = 0; zone < zones; zone++) {
+        int first_row = row;
+        double target = total * (zone + 1) / zones;
+        double band_cost = 0.0;
+
+        while (row < img.height && (zone == zones - 1 || done + row_cost[row] / 2.0 <= target)) {
+            done += row_cost[row];
+            band_cost += row_cost[row];
+            row++;
+        }
+
+        make_band(&bands[zone], view, img, first_row, row);
+        estimate[zone] = band_cost;
+    }
+}
+
+// mirrored rows and reused pixels are copied, not rendered, so they cost nothing
+static void drop_copied_pixels(double* row_cost, Rect view, Bound img, const WorkUnit* frame)
+{
+    WorkUnit whole = *frame;
+    make_band(&whole, view, img, 0, img.height);
+
+    for (int y = 0; y < img.height; y++) {
+        int first;
+        if (mirror_row(&whole, y) >= 0) {
+            row_cost[y] = 0.0;
+        } else {
+            row_cost[y] *= (double)rendered_columns(&whole, y, &first) / img.width;
+        }
+    }
+}
+
+void partition_equal(WorkUnit* bands, double* estimate, int zones, Rect view, Bound img, const WorkUnit* frame)
+{
+    if (frame->mirror > 0 || frame->reuse) {
+        // equal numbers of rendered pixels
+        double* row_cost = malloc(img.height * sizeof(double));
+        for (int y = 0; y < img.height; y++) {
+            row_cost[y] = img.width;
+        }
+
+        drop_copied_pixels(row_cost, view, img, frame);
+        cut_bands(bands, estimate, zones, view, img, row_cost);
+        free(row_cost);
+        return;
+    }
+
+    int first_row = 0;
+    for (int zone = 0; zone < zones; zone++) {
+        // spread the remainder over the first bands instead of dropping it
+        int rows = img.height / zones + (zone < img.height % zones ? 1 : 0);
+
+        make_band(&bands[zone], view, img, first_row, first_row + rows);
+        estimate[zone] = (double)bound_length(bands[zone].bound);
+        first_row += rows;
+    }
+}
+
+void partition_cost(WorkUnit* bands, double* estimate, int zones, Rect view, Bound img, const Kernel* kernel, const Tuning* tuning, const WorkUnit* frame)
+{
+    double* row_cost = estimate_row_costs(view, img, kernel, tuning);
+
+    drop_copied_pixels(row_cost, view, img, frame);
+
+    cut_bands(bands, estimate, zones, view, img, row_cost);
+    free(row_cost);
+}
+
+// moves each band boundary on an odd row up by one, for outputs that pair rows
+void even_band_rows(WorkUnit* bands, int zones, Rect view, Bound img)
+{
+    for (int zone = 1; zone < zones; zone++) {
+        int first = bands[zone].row_offset & ~1u;
+        int end = bands[zone].row_offset + bands[zone].bound.height;
+
+        if (first != (int)bands[zone].row_offset) {
+            make_band(&bands[zone - 1], view, img, bands[zone - 1].row_offset, first);
+            make_band(&bands[zone], view, img, first, end);
+        }
+    }
+}
+
+static double imbalance(const double* values, int count, double* total)
+{
+    double sum = 0.0, max = 0.0;
+    for (int i = 0; i < count; i++) {
+        sum += values[i];
+        if (values[i] > max) {
+            max = values[i];
+        }
+    }
+
+    *total = sum;
+    return sum > 0.0 ? max / (sum / count) : 1.0;
+}
+
+void report_imbalance(const WorkUnit* bands, const double* estimate, const double* measured, int zones)
+{
+    double estimate_total, measured_total;
+    double estimate_imbalance = imbalance(estimate, zones, &estimate_total);
+    double measured_imbalance = imbalance(measured, zones, &measured_total);
+
+    printf("Band  rows              estimate  measured\n");
+    for (int zone = 0; zone < zones; zone++) {
+        printf("%4d  %6u - %-6u     %6.2f%%   %6.2f%%  (%.3fs)\n", zone,
+            bands[zone].row_offset, bands[zone].row_offset + bands[zone].bound.height,
+            estimate_total > 0.0 ? 100.0 * estimate[zone] / estimate_total : 0.0,
+            measured_total > 0.0 ? 100.0 * measured[zone] / measured_total : 0.0,
+            measured[zone]);
+    }
+    printf("Load imbalance (max/mean): estimated %.3f, achieved %.3f\n", estimate_imbalance, measured_imbalance);
+}
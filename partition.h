@@ -0,0 +1,40 @@
+#ifndef _PARTITION_H_
+#define _PARTITION_H_
+
+#include "kernels.h"
+#include "mpi_test.h"
+
+typedef enum PartitionMode {
+    PARTITION_EQUAL,
+    PARTITION_COST,
+} PartitionMode;
+
+// Pre-pass renders at 1/(PREPASS_FACTOR^2) of the pixels with a capped iteration count
+#define PREPASS_FACTOR 4
+#define PREPASS_ITERATIONS 64
+
+// Significant bits kept in the row step of a view aligned for mirroring, so
+// step * row is exact for any row below MIRROR_MAX_ROWS
+#define MIRROR_STEP_BITS 35
+#define MIRROR_MAX_ROWS (1 << 16)
+
+int parse_partition_mode(const char* name, PartitionMode* mode);
+
+void make_band(WorkUnit* band, Rect view, Bound img, int first_row, int end_row);
+
+uint32_t align_mirror(Rect* view, Bound img, const Kernel* kernel);
+void fill_mirrored_rows(const WorkUnit* work, uint32_t* iterations, MPI_Comm comm);
+int band_of_row(const uint32_t* first_rows, int ranks, int row);
+
+double* estimate_row_costs(Rect view, Bound img, const Kernel* kernel, const Tuning* tuning);
+
+// The mirror and reuse fields of frame say which pixels are copied rather
+// than rendered; bands are balanced on the rendered ones only.
+void partition_equal(WorkUnit* bands, double* estimate, int zones, Rect view, Bound img, const WorkUnit* frame);
+void partition_cost(WorkUnit* bands, double* estimate, int zones, Rect view, Bound img, const Kernel* kernel, const Tuning* tuning, const WorkUnit* frame);
+
+void even_band_rows(WorkUnit* bands, int zones, Rect view, Bound img);
+
+void report_imbalance(const WorkUnit* bands, const double* estimate, const double* measured, int zones);
+
+#endif
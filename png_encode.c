@@ -0,0 +1,335 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "png_encode.h"
+
+enum {
+    FILTER_NONE,
+    FILTER_SUB,
+    FILTER_UP,
+    FILTER_AVERAGE,
+    FILTER_PAETH,
+    FILTER_TYPES,
+};
+
+static void put_u32(uint8_t* buffer, uint32_t value)
+{
+    buffer[0] = value >> 24;
+    buffer[1] = value >> 16;
+    buffer[2] = value >> 8;
+    buffer[3] = value;
+}
+
+// writes length, type and crc around a payload already at buffer + 8
+static size_t frame_chunk(uint8_t* buffer, const char* type, size_t length)
+{
+    put_u32(buffer, length);
+    memcpy(buffer + 4, type, 4);
+    put_u32(buffer + 8 + length, crc32(0, buffer + 4, length + 4));
+
+    return length + 12;
+}
+
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+
+    return pb <= pc ? b : c;
+}
+
+static uint64_t filter_row(uint8_t* out, int type, const uint8_t* row, const uint8_t* above, size_t length)
+{
+    const size_t bpp = sizeof(Pixel);
+    uint64_t cost = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        uint8_t a = i >= bpp ? row[i - bpp] : 0;
+        uint8_t b = above ? above[i] : 0;
+        uint8_t c = (above && i >= bpp) ? above[i - bpp] : 0;
+        uint8_t predicted;
+
+        switch (type) {
+        case FILTER_SUB:
+            predicted = a;
+            break;
+        case FILTER_UP:
+            predicted = b;
+            break;
+        case FILTER_AVERAGE:
+            predicted = (a + b) / 2;
+            break;
+        case FILTER_PAETH:
+            predicted = paeth(a, b, c);
+            break;
+        default:
+            predicted = 0;
+            break;
+        }
+
+        out[i] = row[i] - predicted;
+        cost += (int8_t)out[i] < 0 ? -(int8_t)out[i] : out[i];
+    }
+
+    return cost;
+}
+
+size_t png_band_buffer_size(Bound bound)
+{
+    size_t row_length = (size_t)bound.width * sizeof(Pixel);
+    size_t raw_length = (row_length + 1) * bound.height;
+    size_t compressed = compressBound(raw_length) + 16;
+    size_t chunks = compressed / PNG_CHUNK_MAX + 2;
+
+    return pool_size(raw_length) + pool_size(FILTER_TYPES * row_length) + pool_size(compressed + 12 * chunks);
+}
+
+int encode_png_band(EncodedBand* band, const Pixel* pixels, Bound bound, int first, int last, BufferPool* pool)
+{
+    size_t row_length = (size_t)bound.width * sizeof(Pixel);
+    size_t raw_length = (row_length + 1) * bound.height;
+    size_t compressed = compressBound(raw_length) + 16;
+    size_t chunks = compressed / PNG_CHUNK_MAX + 2;
+
+    uint8_t* raw = pool_get(pool, raw_length);
+    uint8_t* candidates = pool_get(pool, FILTER_TYPES * row_length);
+    uint8_t* out = pool_get(pool, compressed + 12 * chunks);
+
+    // The first row of a band is filtered without the row above, which lives
+    // on another rank; None and Sub are the only filters that do not need it.
+    const uint8_t* image = (const uint8_t*)pixels;
+    for (int y = 0; y < bound.height; y++) {
+        const uint8_t* row = image + y * row_length;
+        const uint8_t* above = y > 0 ? row - row_length : NULL;
+        int types = y > 0 ? FILTER_TYPES : FILTER_UP;
+
+        int best = FILTER_NONE;
+        uint64_t best_cost = UINT64_MAX;
+        for (int type = 0; type < types; type++) {
+            uint64_t cost = filter_row(candidates + type * row_length, type, row, above, row_length);
+            if (cost < best_cost) {
+                best = type;
+                best_cost = cost;
+            }
+        }
+
+        uint8_t* filtered = raw + y * (row_length + 1);
+        filtered[0] = best;
+        memcpy(filtered + 1, candidates + best * row_length, row_length);
+    }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+
+    stream.next_in = raw;
+    stream.avail_in = raw_length;
+
+    // deflate straight into chunk payloads, leaving room for each chunk header
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    uint64_t length = 0;
+    int done = 0;
+    while (!done) {
+        uint8_t* payload = out + length + 8;
+        size_t header = 0;
+
+        if (length == 0 && first) {
+            // zlib header: deflate, 32K window, default compression
+            payload[0] = 0x78;
+            payload[1] = 0x9c;
+            header = 2;
+        }
+
+        stream.next_out = payload + header;
+        stream.avail_out = PNG_CHUNK_MAX - header;
+
+        int result = deflate(&stream, flush);
+        if (result == Z_STREAM_ERROR) {
+            deflateEnd(&stream);
+            return -1;
+        }
+
+        done = last ? result == Z_STREAM_END : stream.avail_out != 0;
+        length += frame_chunk(out + length, "IDAT", PNG_CHUNK_MAX - stream.avail_out);
+    }
+
+    deflateEnd(&stream);
+
+    band->data = out;
+    band->length = length;
+    band->raw_length = raw_length;
+    band->adler = adler32(adler32(0, NULL, 0), raw, raw_length);
+
+    return 0;
+}
+
+size_t png_header(uint8_t* buffer, Bound size)
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+    memcpy(buffer, signature, 8);
+
+    uint8_t* ihdr = buffer + 8 + 8;
+    put_u32(ihdr, size.width);
+    put_u32(ihdr + 4, size.height);
+    ihdr[8] = 8; // bit depth
+    ihdr[9] = 2; // truecolour
+    ihdr[10] = 0; // deflate
+    ihdr[11] = 0; // adaptive filtering
+    ihdr[12] = 0; // no interlace
+
+    return 8 + frame_chunk(buffer + 8, "IHDR", 13);
+}
+
+// keyword and text, when given, go in a tEXt chunk between the image data and IEND
+size_t png_trailer(uint8_t* buffer, const EncodedBand* bands, int count, const char* keyword, const char* text)
+{
+    uint32_t adler = adler32(0, NULL, 0);
+    for (int i = 0; i < count; i++) {
+        adler = adler32_combine(adler, bands[i].adler, bands[i].raw_length);
+    }
+
+    // the zlib trailer goes in a chunk of its own so no band has to wait for it
+    put_u32(buffer + 8, adler);
+    size_t length = frame_chunk(buffer, "IDAT", 4);
+
+    if (keyword != NULL && text != NULL) {
+        int payload = snprintf((char*)buffer + length + 8, PNG_TEXT_MAX, "%s%c%s", keyword, '\0', text);
+        if (payload >= PNG_TEXT_MAX) {
+            payload = PNG_TEXT_MAX - 1;
+        }
+        length += frame_chunk(buffer + length, "tEXt", payload);
+    }
+
+    return length + frame_chunk(buffer + length, "IEND", 0);
+}
+
+static int write_all(int fd, const uint8_t* data, uint64_t length, uint64_t offset)
+{
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, offset);
+        if (written < 0) {
+            return -1;
+        }
+
+        data += written;
+        length -= written;
+        offset += written;
+    }
+
+    return 0;
+}
+
+/*
+ * Collective: every rank passes its own encoded band, in band order. Only the
+ * compressed bytes travel; with parallel set they do not travel at all and
+ * every rank writes its chunks at its own offset in the shared file. Root's
+ * keyword and text, if any, are stored as a tEXt chunk.
+ */
+int write_png_bands(const EncodedBand* band, Bound size, const char* file_name, const char* keyword, const char* text, int parallel, MPI_Comm comm)
+{
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    EncodedBand* bands = NULL;
+    if (rank == 0) {
+        bands = malloc(ranks * sizeof(EncodedBand));
+    }
+
+    uint64_t info[3] = { band->length, band->raw_length, band->adler };
+    uint64_t* all = rank == 0 ? malloc(ranks * sizeof(info)) : NULL;
+    MPI_Gather(info, 3, MPI_UINT64_T, all, 3, MPI_UINT64_T, 0, comm);
+
+    uint8_t header[PNG_HEADER_LENGTH];
+    uint8_t trailer[PNG_TRAILER_LENGTH + PNG_TEXT_MAX + 12];
+    uint64_t total = 0;
+    int fd = -1;
+    int status = 0;
+
+    if (rank == 0) {
+        for (int r = 0; r < ranks; r++) {
+            bands[r].data = NULL;
+            bands[r].length = all[r * 3];
+            bands[r].raw_length = all[r * 3 + 1];
+            bands[r].adler = all[r * 3 + 2];
+            total += bands[r].length;
+        }
+
+        png_header(header, size);
+        size_t trailer_length = png_trailer(trailer, bands, ranks, keyword, text);
+
+        fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write_all(fd, header, PNG_HEADER_LENGTH, 0) != 0
+            || write_all(fd, trailer, trailer_length, PNG_HEADER_LENGTH + total) != 0) {
+            perror(file_name);
+            status = -1;
+        }
+    }
+
+    if (parallel) {
+        uint64_t offset = 0;
+        MPI_Exscan(&band->length, &offset, 1, MPI_UINT64_T, MPI_SUM, comm);
+        if (rank == 0) {
+            offset = 0;
+        }
+
+        // the file exists once root has written the header
+        MPI_Bcast(&status, 1, MPI_INT, 0, comm);
+        if (status == 0 && rank != 0) {
+            fd = open(file_name, O_WRONLY);
+        }
+
+        if (status == 0 && (fd < 0 || write_all(fd, band->data, band->length, PNG_HEADER_LENGTH + offset) != 0)) {
+            perror(file_name);
+            status = -1;
+        }
+
+        MPI_Allreduce(MPI_IN_PLACE, &status, 1, MPI_INT, MPI_MIN, comm);
+    } else {
+        int* counts = NULL;
+        int* displs = NULL;
+        uint8_t* data = NULL;
+
+        if (rank == 0) {
+            counts = malloc(ranks * sizeof(int));
+            displs = malloc(ranks * sizeof(int));
+            for (int r = 0, offset = 0; r < ranks; r++) {
+                counts[r] = bands[r].length;
+                displs[r] = offset;
+                offset += counts[r];
+            }
+            data = malloc(total);
+        }
+
+        MPI_Gatherv(band->data, band->length, MPI_BYTE, data, counts, displs, MPI_BYTE, 0, comm);
+
+        if (rank == 0 && status == 0 && write_all(fd, data, total, PNG_HEADER_LENGTH) != 0) {
+            perror(file_name);
+            status = -1;
+        }
+
+        free(counts);
+        free(displs);
+        free(data);
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    free(bands);
+    free(all);
+    return status;
+}
@@ -0,0 +1,36 @@
+#ifndef _PNG_ENCODE_H_
+#define _PNG_ENCODE_H_
+
+#include "mpi_test.h"
+#include "pool.h"
+
+// IDAT payload per chunk; larger bands are split over several chunks
+#define PNG_CHUNK_MAX (1 << 24)
+
+#define PNG_HEADER_LENGTH (8 + 25)
+#define PNG_TRAILER_LENGTH (16 + 12)
+
+// Longest text written into the trailer as a tEXt chunk, keyword included
+#define PNG_TEXT_MAX 256
+
+// One band of a PNG image, filtered and deflated on its own. data holds
+// complete IDAT chunks ready to be concatenated with the other bands: every
+// band but the last ends on a sync flush so the deflate streams join up,
+// the first band carries the zlib header and the caller appends the Adler-32
+// of the whole image with png_trailer().
+typedef struct EncodedBand {
+    uint8_t* data;
+    uint64_t length;
+    uint64_t raw_length;
+    uint64_t adler;
+} EncodedBand;
+
+size_t png_band_buffer_size(Bound bound);
+int encode_png_band(EncodedBand* band, const Pixel* pixels, Bound bound, int first, int last, BufferPool* pool);
+
+size_t png_header(uint8_t* buffer, Bound size);
+size_t png_trailer(uint8_t* buffer, const EncodedBand* bands, int count, const char* keyword, const char* text);
+
+int write_png_bands(const EncodedBand* band, Bound size, const char* file_name, const char* keyword, const char* text, int parallel, MPI_Comm comm);
+
+#endif
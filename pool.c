@@ -0,0 +1,106 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+void pool_init(BufferPool* pool)
+{
+    pool->base = NULL;
+    pool->capacity = 0;
+    pool->used = 0;
+    pool->peak = 0;
+    pool->allocations = 0;
+}
+
+size_t pool_size(size_t bytes)
+{
+    return (bytes + POOL_ALIGNMENT - 1) & ~((size_t)POOL_ALIGNMENT - 1);
+}
+
+void pool_reserve(BufferPool* pool, size_t bytes)
+{
+    assert(pool->used == 0);
+
+    if (bytes <= pool->capacity) {
+        return;
+    }
+
+    if (pool->base) {
+        MPI_Free_mem(pool->base);
+    }
+
+    if (MPI_Alloc_mem(bytes, MPI_INFO_NULL, &pool->base) != MPI_SUCCESS) {
+        printf("Unable to allocate %zu bytes for buffer pool\n", bytes);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    pool->capacity = bytes;
+    pool->allocations++;
+}
+
+void pool_reset(BufferPool* pool)
+{
+    pool->used = 0;
+}
+
+void* pool_get(BufferPool* pool, size_t bytes)
+{
+    size_t size = pool_size(bytes);
+
+    if (pool->used + size > pool->capacity) {
+        printf("Buffer pool exhausted: %zu of %zu bytes in use, %zu requested\n", pool->used, pool->capacity, size);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    void* buffer = pool->base + pool->used;
+    pool->used += size;
+    if (pool->used > pool->peak) {
+        pool->peak = pool->used;
+    }
+
+    return buffer;
+}
+
+void pool_free(BufferPool* pool)
+{
+    if (pool->base) {
+        MPI_Free_mem(pool->base);
+    }
+
+    pool_init(pool);
+}
+
+/*
+ * Collective: root prints every rank's pool high-water mark (the most any
+ * frame took from it), its capacity (what is allocated, the largest reserve
+ * of the run) and how many times it was reallocated. Only the pool is
+ * counted; buffers allocated outside it are listed after the table.
+ */
+void report_pool_usage(const BufferPool* pool, MPI_Comm comm)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    uint64_t usage[3] = { pool->peak, pool->capacity, pool->allocations };
+    uint64_t* all = NULL;
+    if (rank == 0) {
+        all = malloc(sizeof(usage) * size);
+    }
+
+    MPI_Gather(usage, 3, MPI_UINT64_T, all, 3, MPI_UINT64_T, 0, comm);
+
+    if (rank == 0) {
+        printf("Rank  high-water (MiB)  capacity (MiB)  allocations\n");
+        for (int r = 0; r < size; r++) {
+            printf("%4d  %16.2f  %14.2f  %11llu\n", r,
+                all[r * 3] / (1024.0 * 1024.0),
+                all[r * 3 + 1] / (1024.0 * 1024.0),
+                (unsigned long long)all[r * 3 + 2]);
+        }
+        printf("Not in the pool: writer band buffers, density strip grids, zoom frame history, refine pending lists,\n"
+               "root's PNG gather buffer, Deep Zoom row and tile buffers, video frame queue\n");
+        free(all);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mpi.h>
+
+// Per-rank buffer pool backed by MPI_Alloc_mem so the interconnect can keep
+// it registered. Buffers are handed out bump-allocator style and all of them
+// are released together by pool_reset() between frames; the backing memory
+// is only replaced when a frame needs more than the current capacity.
+typedef struct BufferPool {
+    char* base;
+    size_t capacity;
+    size_t used;
+    size_t peak;
+    uint64_t allocations;
+} BufferPool;
+
+#define POOL_ALIGNMENT 64
+
+void pool_init(BufferPool* pool);
+void pool_reserve(BufferPool* pool, size_t bytes);
+void pool_reset(BufferPool* pool);
+void* pool_get(BufferPool* pool, size_t bytes);
+void pool_free(BufferPool* pool);
+
+size_t pool_size(size_t bytes);
+
+void report_pool_usage(const BufferPool* pool, MPI_Comm comm);
+
+#endif
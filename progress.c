@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "progress.h"
+
+/*
+ * Collective: root's interval is broadcast so every rank agrees on whether
+ * updates are sent at all. status_file is only used on root.
+ */
+void progress_init(Progress* progress, double interval, const char* status_file, MPI_Comm comm)
+{
+    MPI_Comm_dup(comm, &progress->comm);
+    MPI_Comm_rank(progress->comm, &progress->rank);
+    MPI_Comm_size(progress->comm, &progress->ranks);
+    MPI_Bcast(&interval, 1, MPI_DOUBLE, 0, progress->comm);
+
+    progress->interval = interval > 0.0 ? interval : 0.0;
+
+    int threading;
+    MPI_Query_thread(&threading);
+    progress->funneled = threading >= MPI_THREAD_FUNNELED;
+    progress->request = MPI_REQUEST_NULL;
+    progress->reports = NULL;
+    progress->finished = NULL;
+    progress->collecting = 0;
+    progress->status_file = status_file;
+
+    if (progress->rank == 0) {
+        progress->reports = calloc(3 * progress->ranks, sizeof(double));
+        progress->finished = calloc(progress->ranks, sizeof(int));
+    }
+}
+
+void progress_start(Progress* progress, uint64_t rows_total, Bound img)
+{
+    progress->start = MPI_Wtime();
+    progress->last = progress->start;
+    progress->rows_done = 0;
+    progress->rows_total = rows_total;
+    progress->image_rows = img.height;
+    progress->width = img.width;
+
+    if (progress->rank == 0) {
+        for (int r = 0; r < progress->ranks; r++) {
+            progress->finished[r] = 0;
+        }
+    }
+}
+
+static void record(Progress* progress, int rank, const double* message)
+{
+    for (int i = 0; i < 3; i++) {
+        progress->reports[rank * 3 + i] = message[i];
+    }
+
+    progress->finished[rank] = message[3] != 0.0;
+}
+
+// seconds until the slowest rank finishes, extrapolated from its rate so far
+static double projected_finish(const Progress* progress)
+{
+    double remaining = 0.0;
+
+    for (int r = 0; r < progress->ranks; r++) {
+        const double* report = progress->reports + r * 3;
+        double left;
+
+        if (progress->finished[r]) {
+            continue;
+        } else if (report[0] > 0.0) {
+            left = report[2] * (report[1] - report[0]) / report[0] - (MPI_Wtime() - progress->start - report[2]);
+        } else {
+            return -1.0;
+        }
+
+        if (left > remaining) {
+            remaining = left;
+        }
+    }
+
+    return remaining;
+}
+
+static void write_status_file(const Progress* progress, double eta)
+{
+    char temporary[1024];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", progress->status_file);
+
+    FILE* file = fopen(temporary, "w");
+    if (file == NULL) {
+        perror(temporary);
+        return;
+    }
+
+    fprintf(file, "elapsed %.1fs, eta %.1fs\n", MPI_Wtime() - progress->start, eta);
+    fprintf(file, "Rank  rows done  rows total  pixels/s\n");
+    for (int r = 0; r < progress->ranks; r++) {
+        const double* report = progress->reports + r * 3;
+
+        fprintf(file, "%4d  %9.0f  %10.0f  %8.3g\n", r, report[0], report[1],
+            report[2] > 0.0 ? report[0] * progress->width / report[2] : 0.0);
+    }
+    fclose(file);
+
+    // readers only ever see a complete file
+    rename(temporary, progress->status_file);
+}
+
+static void report(const Progress* progress)
+{
+    double done = 0.0, rate = 0.0;
+    int finished = 0;
+
+    for (int r = 0; r < progress->ranks; r++) {
+        const double* report = progress->reports + r * 3;
+
+        done += report[0];
+        rate += report[2] > 0.0 ? report[0] * progress->width / report[2] : 0.0;
+        finished += progress->finished[r];
+    }
+
+    double eta = projected_finish(progress);
+    printf("Progress: %5.1f%%, %d/%d ranks done, %.3g pixels/s, ",
+        progress->image_rows > 0 ? 100.0 * done / progress->image_rows : 100.0, finished, progress->ranks, rate);
+    if (eta < 0.0) {
+        printf("eta unknown\n");
+    } else {
+        printf("eta %.1fs\n", eta);
+    }
+    fflush(stdout);
+
+    if (progress->status_file) {
+        write_status_file(progress, eta);
+    }
+}
+
+static void fill_message(Progress* progress, double now, int final)
+{
+    uint64_t rows_done;
+
+#pragma omp atomic read
+    rows_done = progress->rows_done;
+
+    progress->message[0] = rows_done;
+    progress->message[1] = progress->rows_total;
+    progress->message[2] = now - progress->start;
+    progress->message[3] = final;
+}
+
+static void drain(Progress* progress)
+{
+    int pending;
+    MPI_Status status;
+    double message[PROGRESS_FIELDS];
+
+    MPI_Iprobe(MPI_ANY_SOURCE, PROGRESS_TAG, progress->comm, &pending, &status);
+    while (pending) {
+        MPI_Recv(message, PROGRESS_FIELDS, MPI_DOUBLE, status.MPI_SOURCE, PROGRESS_TAG, progress->comm, MPI_STATUS_IGNORE);
+        record(progress, status.MPI_SOURCE, message);
+        MPI_Iprobe(MPI_ANY_SOURCE, PROGRESS_TAG, progress->comm, &pending, &status);
+    }
+}
+
+// Workers never wait here: an update is skipped while the previous one is
+// still in flight. Root only touches the network when an update is due.
+static void poll(Progress* progress)
+{
+    double now = MPI_Wtime();
+    if (now - progress->last < progress->interval) {
+        return;
+    }
+    progress->last = now;
+
+    if (progress->rank == 0) {
+        fill_message(progress, now, 0);
+        record(progress, 0, progress->message);
+        drain(progress);
+        report(progress);
+        return;
+    }
+
+    int sent = 1;
+    if (progress->request != MPI_REQUEST_NULL) {
+        MPI_Test(&progress->request, &sent, MPI_STATUS_IGNORE);
+    }
+
+    if (sent) {
+        fill_message(progress, now, 0);
+        MPI_Isend(progress->message, PROGRESS_FIELDS, MPI_DOUBLE, 0, PROGRESS_TAG, progress->comm, &progress->request);
+    }
+}
+
+// Safe to call from any thread; only the main thread talks to MPI.
+void progress_add(Progress* progress, uint64_t rows)
+{
+    if (progress->interval == 0.0) {
+        return;
+    }
+
+#pragma omp atomic
+    progress->rows_done += rows;
+
+#ifdef _OPENMP
+    if (omp_get_thread_num() != 0 || (!progress->funneled && omp_in_parallel())) {
+        return;
+    }
+#endif
+
+    poll(progress);
+}
+
+/*
+ * Every rank sends a final update once its band is rendered. Root only
+ * records its own here and hears from the others in progress_collect(), so
+ * its band is not timed as the slowest rank's.
+ */
+void progress_finish(Progress* progress)
+{
+    if (progress->interval == 0.0) {
+        return;
+    }
+
+    double now = MPI_Wtime();
+    progress->rows_done = progress->rows_total;
+
+    if (progress->rank != 0) {
+        MPI_Wait(&progress->request, MPI_STATUS_IGNORE);
+        fill_message(progress, now, 1);
+        MPI_Send(progress->message, PROGRESS_FIELDS, MPI_DOUBLE, 0, PROGRESS_TAG, progress->comm);
+        return;
+    }
+
+    fill_message(progress, now, 1);
+    record(progress, 0, progress->message);
+    progress->collecting = 1;
+}
+
+// Root keeps reporting until every rank's final update of the band is in
+void progress_collect(Progress* progress)
+{
+    if (progress->rank != 0 || !progress->collecting) {
+        return;
+    }
+    progress->collecting = 0;
+
+    for (int r = 0; r < progress->ranks; r++) {
+        while (!progress->finished[r]) {
+            int pending = 0;
+            MPI_Status status;
+            double message[PROGRESS_FIELDS];
+
+            // block for the next update, but keep the status line fresh
+            MPI_Iprobe(MPI_ANY_SOURCE, PROGRESS_TAG, progress->comm, &pending, &status);
+            if (!pending && MPI_Wtime() - progress->last >= progress->interval) {
+                progress->last = MPI_Wtime();
+                report(progress);
+            }
+
+            if (!pending) {
+                MPI_Probe(MPI_ANY_SOURCE, PROGRESS_TAG, progress->comm, &status);
+            }
+
+            MPI_Recv(message, PROGRESS_FIELDS, MPI_DOUBLE, status.MPI_SOURCE, PROGRESS_TAG, progress->comm, MPI_STATUS_IGNORE);
+            record(progress, status.MPI_SOURCE, message);
+        }
+    }
+
+    report(progress);
+}
+
+void progress_free(Progress* progress)
+{
+    MPI_Comm_free(&progress->comm);
+    free(progress->reports);
+    free(progress->finished);
+    progress->reports = NULL;
+    progress->finished = NULL;
+}
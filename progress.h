@@ -0,0 +1,47 @@
+#ifndef _PROGRESS_H_
+#define _PROGRESS_H_
+
+#include <stdint.h>
+
+#include <mpi.h>
+
+#include "mpi_test.h"
+
+#define PROGRESS_INTERVAL 2.0
+#define PROGRESS_TAG 1
+#define PROGRESS_FIELDS 4
+
+// Live render progress. Every rank counts the rows it has finished and, at
+// most once per interval, posts a non-blocking update to root on a private
+// communicator; root folds the updates into a status line (and optionally
+// a status file) while it renders its own band.
+typedef struct Progress {
+    MPI_Comm comm;
+    int rank;
+    int ranks;
+    double interval; // zero disables progress reporting
+    int funneled; // MPI may be called from the main thread of a parallel region
+    double start;
+    double last;
+    uint64_t rows_done;
+    uint64_t rows_total;
+    uint64_t image_rows;
+    uint32_t width;
+    MPI_Request request;
+    double message[PROGRESS_FIELDS]; // rows done, rows total, seconds since start, final
+
+    // root only
+    double* reports; // the latest message from every rank
+    int* finished;
+    int collecting; // progress_finish() ran, progress_collect() has yet to wait for the others
+    const char* status_file;
+} Progress;
+
+void progress_init(Progress* progress, double interval, const char* status_file, MPI_Comm comm);
+void progress_start(Progress* progress, uint64_t rows_total, Bound img);
+void progress_add(Progress* progress, uint64_t rows);
+void progress_finish(Progress* progress);
+void progress_collect(Progress* progress);
+void progress_free(Progress* progress);
+
+#endif
@@ -0,0 +1,242 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "image_io.h"
+#include "pyramid.h"
+
+// Index of the full resolution level; level 0 is a single pixel
+int pyramid_levels(Bound img)
+{
+    uint32_t size = img.width > img.height ? img.width : img.height;
+    int level = 0;
+
+    while (level < 31 && (1u << level) < size) {
+        level++;
+    }
+
+    return level;
+}
+
+static uint32_t level_length(uint32_t length, int shift)
+{
+    return ((uint64_t)length + (1ull << shift) - 1) >> shift;
+}
+
+// render.dzi keeps its tiles in render_files/<level>/<column>_<row>.png
+static void tile_directory(char* name, const char* file_name, int level)
+{
+    const char* dot = strrchr(file_name, '.');
+    int stem = dot ? (int)(dot - file_name) : (int)strlen(file_name);
+
+    if (level < 0) {
+        snprintf(name, OUTPUT_NAME_MAX, "%.*s_files", stem, file_name);
+    } else {
+        snprintf(name, OUTPUT_NAME_MAX, "%.*s_files/%d", stem, file_name, level);
+    }
+}
+
+static int create_pyramid(const char* file_name, Bound img, int levels)
+{
+    char name[OUTPUT_NAME_MAX];
+
+    for (int level = -1; level <= levels; level++) {
+        tile_directory(name, file_name, level);
+        if (mkdir(name, 0755) != 0 && errno != EEXIST) {
+            perror(name);
+            return -1;
+        }
+    }
+
+    FILE* descriptor = fopen(file_name, "w");
+    if (descriptor == NULL) {
+        perror(file_name);
+        return -1;
+    }
+
+    fprintf(descriptor, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(descriptor, "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"png\" Overlap=\"0\" TileSize=\"%d\">\n", PYRAMID_TILE_SIZE);
+    fprintf(descriptor, "    <Size Width=\"%u\" Height=\"%u\"/>\n", img.width, img.height);
+    fprintf(descriptor, "</Image>\n");
+
+    return fclose(descriptor) == 0 ? 0 : -1;
+}
+
+/*
+ * Collective: moves rows between ranks so that each rank's rows start on the
+ * tile boundary nearest to its current first row. Rows only cross the band
+ * boundaries, so a rank trades at most half a tile row with its neighbours.
+ * Returns the rank's new rows and updates first and end to match.
+ */
+static Pixel* align_rows(const Pixel* rows, Bound size, int* first, int* end, MPI_Comm comm)
+{
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+    size_t count = (size_t)ranks;
+
+    int range[2] = { *first, *end };
+    int* ranges = malloc(2 * count * sizeof(int));
+    MPI_Allgather(range, 2, MPI_INT, ranges, 2, MPI_INT, comm);
+
+    int* aligned = malloc((count + 1) * sizeof(int));
+    for (int r = 0; r < ranks; r++) {
+        int boundary = (ranges[2 * r] + PYRAMID_TILE_SIZE / 2) / PYRAMID_TILE_SIZE * PYRAMID_TILE_SIZE;
+        aligned[r] = r == 0 ? 0 : (boundary < (int)size.height ? boundary : (int)size.height);
+    }
+    aligned[ranks] = size.height;
+
+    int* send_counts = calloc(count, sizeof(int));
+    int* send_displs = calloc(count, sizeof(int));
+    int* recv_counts = calloc(count, sizeof(int));
+    int* recv_displs = calloc(count, sizeof(int));
+
+    for (int r = 0; r < ranks; r++) {
+        int low = *first > aligned[r] ? *first : aligned[r];
+        int high = *end < aligned[r + 1] ? *end : aligned[r + 1];
+        if (high > low) {
+            send_counts[r] = high - low;
+            send_displs[r] = low - *first;
+        }
+
+        low = ranges[2 * r] > aligned[rank] ? ranges[2 * r] : aligned[rank];
+        high = ranges[2 * r + 1] < aligned[rank + 1] ? ranges[2 * r + 1] : aligned[rank + 1];
+        if (high > low) {
+            recv_counts[r] = high - low;
+            recv_displs[r] = low - aligned[rank];
+        }
+    }
+
+    MPI_Datatype row_type;
+    MPI_Type_contiguous(size.width * sizeof(Pixel), MPI_BYTE, &row_type);
+    MPI_Type_commit(&row_type);
+
+    int rows_owned = aligned[rank + 1] - aligned[rank];
+    Pixel* result = malloc(((size_t)(rows_owned > 0 ? rows_owned : 1)) * size.width * sizeof(Pixel));
+    MPI_Alltoallv(rows, send_counts, send_displs, row_type, result, recv_counts, recv_displs, row_type, comm);
+
+    *first = aligned[rank];
+    *end = aligned[rank + 1];
+
+    MPI_Type_free(&row_type);
+    free(ranges);
+    free(aligned);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+    return result;
+}
+
+// 2x2 box filter; the last row or column of an odd sized level pairs with itself
+static void downsample(const Pixel* src, int width, int rows, Pixel* dst, int half_width)
+{
+    for (int y = 0; y < (rows + 1) / 2; y++) {
+        const Pixel* top = src + (size_t)2 * y * width;
+        const Pixel* bottom = 2 * y + 1 < rows ? top + width : top;
+
+        for (int x = 0; x < half_width; x++) {
+            int left = 2 * x;
+            int right = left + 1 < width ? left + 1 : left;
+            Pixel* p = &dst[(size_t)y * half_width + x];
+
+            p->red = (top[left].red + top[right].red + bottom[left].red + bottom[right].red + 2) / 4;
+            p->green = (top[left].green + top[right].green + bottom[left].green + bottom[right].green + 2) / 4;
+            p->blue = (top[left].blue + top[right].blue + bottom[left].blue + bottom[right].blue + 2) / 4;
+        }
+    }
+}
+
+// rows [first, end) of a level start on a tile boundary and end on one or at the bottom
+static int write_tiles(const Pixel* rows, Bound size, int first, int end, int level, const char* file_name, uint64_t* written)
+{
+    char directory[OUTPUT_NAME_MAX];
+    char name[OUTPUT_NAME_MAX + 32];
+    Pixel* tile = malloc(PYRAMID_TILE_SIZE * PYRAMID_TILE_SIZE * sizeof(Pixel));
+    int status = 0;
+
+    tile_directory(directory, file_name, level);
+
+    for (int top = first; top < end; top += PYRAMID_TILE_SIZE) {
+        int tile_rows = end - top < PYRAMID_TILE_SIZE ? end - top : PYRAMID_TILE_SIZE;
+
+        for (int left = 0; left < (int)size.width; left += PYRAMID_TILE_SIZE) {
+            int tile_columns = size.width - left < PYRAMID_TILE_SIZE ? size.width - left : PYRAMID_TILE_SIZE;
+
+            for (int y = 0; y < tile_rows; y++) {
+                memcpy(tile + (size_t)y * tile_columns, rows + (size_t)(top - first + y) * size.width + left, tile_columns * sizeof(Pixel));
+            }
+
+            Bound tile_size = { tile_columns, tile_rows };
+            snprintf(name, sizeof(name), "%s/%d_%d.png", directory, left / PYRAMID_TILE_SIZE, top / PYRAMID_TILE_SIZE);
+            if (write_image(tile, tile_size, name, NULL, NULL) != 0) {
+                status = -1;
+            }
+            (*written)++;
+        }
+    }
+
+    free(tile);
+    return status;
+}
+
+/*
+ * Collective: writes a Deep Zoom pyramid of the image, file_name being its
+ * .dzi descriptor. Every rank passes its coloured band, tiles the rows it
+ * holds once they are aligned to tile boundaries, and halves them for the
+ * next level. Only the rows that cross band boundaries travel; no rank ever
+ * holds more than its own share of a level.
+ */
+void write_pyramid(const Pixel* band, const WorkUnit* work, Bound img, const char* file_name, MPI_Comm comm)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    int levels = pyramid_levels(img);
+    int status = rank == 0 ? create_pyramid(file_name, img, levels) : 0;
+
+    // the directories exist before any rank writes into them
+    MPI_Bcast(&status, 1, MPI_INT, 0, comm);
+    if (status != 0) {
+        MPI_Abort(comm, 1);
+    }
+
+    const Pixel* rows = band;
+    Pixel* halved = NULL;
+    int first = work->row_offset;
+    int end = first + work->bound.height;
+    uint64_t written = 0;
+
+    for (int level = levels; level >= 0; level--) {
+        Bound size = { level_length(img.width, levels - level), level_length(img.height, levels - level) };
+        Pixel* aligned = align_rows(rows, size, &first, &end, comm);
+        free(halved);
+        halved = NULL;
+
+        if (write_tiles(aligned, size, first, end, level, file_name, &written) != 0) {
+            status = -1;
+        }
+
+        if (level > 0) {
+            int half_width = level_length(size.width, 1);
+
+            // first is a tile boundary and even, unless the rank holds nothing at the bottom
+            halved = malloc(((size_t)(end - first + 1) / 2 + 1) * half_width * sizeof(Pixel));
+            downsample(aligned, size.width, end - first, halved, half_width);
+            first = (first + 1) / 2;
+            end = (end + 1) / 2;
+            rows = halved;
+        }
+
+        free(aligned);
+    }
+
+    uint64_t tiles;
+    MPI_Reduce(&written, &tiles, 1, MPI_UINT64_T, MPI_SUM, 0, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &status, 1, MPI_INT, MPI_MIN, comm);
+    if (rank == 0) {
+        printf("Deep Zoom pyramid %s: %d levels, %llu tiles%s\n", file_name, levels + 1, (unsigned long long)tiles, status != 0 ? ", some tiles failed" : "");
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef _PYRAMID_H_
+#define _PYRAMID_H_
+
+#include <mpi.h>
+
+#include "mpi_test.h"
+
+// Edge length of the square tiles of every pyramid level
+#define PYRAMID_TILE_SIZE 256
+
+int pyramid_levels(Bound img);
+void write_pyramid(const Pixel* band, const WorkUnit* work, Bound img, const char* file_name, MPI_Comm comm);
+
+#endif
@@ -0,0 +1,237 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "refine.h"
+
+// Comma separated, strictly increasing limits, e.g. "255,1000,10000"
+int parse_refine_stages(const char* list, uint32_t* stages)
+{
+    int count = 0;
+    const char* cursor = list;
+
+    memset(stages, 0, MAX_REFINE_STAGES * sizeof(uint32_t));
+    while (*cursor != '\0') {
+        char* end;
+        unsigned long limit = strtoul(cursor, &end, 10);
+
+        if (end == cursor || limit == 0 || limit > UINT32_MAX - 1 || count == MAX_REFINE_STAGES
+            || (count > 0 && limit <= stages[count - 1])) {
+            return -1;
+        }
+
+        stages[count++] = limit;
+        cursor = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            return -1;
+        }
+    }
+
+    return count > 0 ? 0 : -1;
+}
+
+void make_mpi_type_PendingPixel(MPI_Datatype* type)
+{
+    int blocklengths[] = { 2, 1, 1 };
+    MPI_Aint displacements[] = {
+        offsetof(PendingPixel, zx),
+        offsetof(PendingPixel, index),
+        offsetof(PendingPixel, iterations),
+    };
+    MPI_Datatype datatypes[] = {
+        MPI_DOUBLE,
+        MPI_UINT64_T,
+        MPI_UINT32_T,
+    };
+    MPI_Datatype packed;
+
+    MPI_Type_create_struct(3, blocklengths, displacements, datatypes, &packed);
+    MPI_Type_create_resized(packed, 0, sizeof(PendingPixel), type);
+    MPI_Type_free(&packed);
+    MPI_Type_commit(type);
+}
+
+static int64_t overlap(int64_t first, int64_t end, int64_t other_first, int64_t other_end)
+{
+    int64_t low = first > other_first ? first : other_first;
+    int64_t high = end < other_end ? end : other_end;
+
+    return high > low ? high - low : 0;
+}
+
+/*
+ * Collective: treats the pending lists of all ranks, concatenated in rank
+ * order, as one list and hands every rank an equal contiguous slice of it.
+ * The order is kept, so slices stay sorted by owning band.
+ */
+static PendingPixel* rebalance(PendingPixel* pending, int* count, MPI_Datatype type, int rank, int ranks, MPI_Comm comm)
+{
+    int64_t* counts = malloc(ranks * sizeof(int64_t));
+    int64_t mine = *count;
+    MPI_Allgather(&mine, 1, MPI_INT64_T, counts, 1, MPI_INT64_T, comm);
+
+    int64_t total = 0, start = 0;
+    for (int r = 0; r < ranks; r++) {
+        if (r == rank) {
+            start = total;
+        }
+        total += counts[r];
+    }
+
+    int* send_counts = calloc(ranks, sizeof(int));
+    int* send_displs = calloc(ranks, sizeof(int));
+    int* recv_counts = calloc(ranks, sizeof(int));
+    int* recv_displs = calloc(ranks, sizeof(int));
+
+    int64_t target_first = total * rank / ranks, target_end = total * (rank + 1) / ranks;
+    int64_t source_first = 0;
+    for (int r = 0; r < ranks; r++) {
+        send_counts[r] = overlap(start, start + mine, total * r / ranks, total * (r + 1) / ranks);
+        recv_counts[r] = overlap(source_first, source_first + counts[r], target_first, target_end);
+        source_first += counts[r];
+
+        if (r > 0) {
+            send_displs[r] = send_displs[r - 1] + send_counts[r - 1];
+            recv_displs[r] = recv_displs[r - 1] + recv_counts[r - 1];
+        }
+    }
+
+    int received = target_end - target_first;
+    PendingPixel* balanced = malloc((received > 0 ? received : 1) * sizeof(PendingPixel));
+    MPI_Alltoallv(pending, send_counts, send_displs, type, balanced, recv_counts, recv_displs, type, comm);
+
+    free(pending);
+    free(counts);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+
+    *count = received;
+    return balanced;
+}
+
+// Collective: returns resumed pixels to the ranks whose bands they belong to
+static PendingPixel* return_to_owners(PendingPixel* pending, int* count, const uint64_t* band_first, MPI_Datatype type, int ranks, MPI_Comm comm)
+{
+    int* send_counts = calloc(ranks, sizeof(int));
+    int* send_displs = calloc(ranks, sizeof(int));
+    int* recv_counts = calloc(ranks, sizeof(int));
+    int* recv_displs = calloc(ranks, sizeof(int));
+
+    // pending is sorted by index, so the owners come in runs
+    for (int n = 0, owner = 0; n < *count; n++) {
+        while (owner < ranks - 1 && pending[n].index >= band_first[owner + 1]) {
+            owner++;
+        }
+        send_counts[owner]++;
+    }
+
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, comm);
+
+    int received = recv_counts[0];
+    for (int r = 1; r < ranks; r++) {
+        send_displs[r] = send_displs[r - 1] + send_counts[r - 1];
+        recv_displs[r] = recv_displs[r - 1] + recv_counts[r - 1];
+        received += recv_counts[r];
+    }
+
+    PendingPixel* owned = malloc((received > 0 ? received : 1) * sizeof(PendingPixel));
+    MPI_Alltoallv(pending, send_counts, send_displs, type, owned, recv_counts, recv_displs, type, comm);
+
+    free(pending);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+
+    *count = received;
+    return owned;
+}
+
+/*
+ * Collective: renders a band in stages of rising iteration limits. Between
+ * stages only the pixels that have not escaped are kept, with their z and
+ * iteration count, and they are spread evenly over the ranks before the
+ * next stage resumes them. The final counts match a single render at the
+ * last limit. on_stage, if not NULL, gets the counts of every earlier stage
+ * so a preview can be shown while the deeper stages run.
+ */
+void refine_band(const WorkUnit* work, Bound img, uint32_t* iterations, const Tuning* tuning, RefineStageFunction on_stage, void* context, MPI_Comm comm)
+{
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    MPI_Datatype type;
+    make_mpi_type_PendingPixel(&type);
+
+    ResumeFunction resume = select_resume(&work->kernel);
+    int threads = tuning->threads > 0 ? tuning->threads : 1;
+
+    uint64_t first = (uint64_t)work->row_offset * img.width;
+    uint64_t* band_first = malloc(ranks * sizeof(uint64_t));
+    MPI_Allgather(&first, 1, MPI_UINT64_T, band_first, 1, MPI_UINT64_T, comm);
+
+    int count = 0;
+    PendingPixel* pending = malloc((bound_length(work->bound) > 0 ? bound_length(work->bound) : 1) * sizeof(PendingPixel));
+    for (int y = 0; y < work->bound.height; y++) {
+        if (mirror_row(work, work->row_offset + y) >= 0) {
+            continue;
+        }
+
+        // pixels carried over from the previous frame are already done
+        int x_first;
+        int x_step = rendered_columns(work, work->row_offset + y, &x_first) == (int)work->bound.width ? 1 : 2;
+        for (int x = x_first; x < work->bound.width; x += x_step) {
+            pending[count].zx = 0.0;
+            pending[count].zy = 0.0;
+            pending[count].index = first + (uint64_t)y * img.width + x;
+            pending[count].iterations = 0;
+            count++;
+        }
+    }
+
+    for (int stage = 0; stage < MAX_REFINE_STAGES && work->refine[stage] > 0; stage++) {
+        uint32_t limit = work->refine[stage];
+        double start = MPI_Wtime();
+
+        pending = rebalance(pending, &count, type, rank, ranks, comm);
+
+        int chunks = (count + REFINE_CHUNK - 1) / REFINE_CHUNK;
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+        for (int chunk = 0; chunk < chunks; chunk++) {
+            int end = (chunk + 1) * REFINE_CHUNK < count ? (chunk + 1) * REFINE_CHUNK : count;
+            resume(work, img.width, pending, chunk * REFINE_CHUNK, end, limit);
+        }
+
+        pending = return_to_owners(pending, &count, band_first, type, ranks, comm);
+
+        int remaining = 0;
+        for (int n = 0; n < count; n++) {
+            iterations[pending[n].index - first] = pending[n].iterations;
+            if (pending[n].iterations >= limit) {
+                pending[remaining++] = pending[n];
+            }
+        }
+        count = remaining;
+
+        int64_t total = count;
+        double elapsed = MPI_Wtime() - start;
+        MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &total, &total, 1, MPI_INT64_T, MPI_SUM, 0, comm);
+        MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &elapsed, &elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+        if (rank == 0) {
+            printf("Refine stage %d: limit %u, %lld pixels still bounded, %.3fs\n",
+                stage + 1, limit, (long long)total, elapsed);
+        }
+
+        if (on_stage != NULL && stage + 1 < MAX_REFINE_STAGES && work->refine[stage + 1] > 0) {
+            on_stage(work, img, iterations, stage, limit, context, comm);
+        }
+    }
+
+    free(pending);
+    free(band_first);
+    MPI_Type_free(&type);
+}
@@ -0,0 +1,20 @@
+#ifndef _REFINE_H_
+#define _REFINE_H_
+
+#include "kernels.h"
+#include "mpi_test.h"
+
+// Pending pixels are resumed in chunks of this many by the render threads
+#define REFINE_CHUNK 1024
+
+int parse_refine_stages(const char* list, uint32_t* stages);
+
+void make_mpi_type_PendingPixel(MPI_Datatype* type);
+
+// Called collectively after every stage but the last, with the band's counts
+// so far. Pixels still bounded hold the stage's limit.
+typedef void (*RefineStageFunction)(const WorkUnit* work, Bound img, uint32_t* iterations, int stage, uint32_t limit, void* context, MPI_Comm comm);
+
+void refine_band(const WorkUnit* work, Bound img, uint32_t* iterations, const Tuning* tuning, RefineStageFunction on_stage, void* context, MPI_Comm comm);
+
+#endif
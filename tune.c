@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "partition.h"
+#include "tune.h"
+
+static const uint32_t tile_row_candidates[] = { 4, 16, 64 };
+
+#define TILE_ROW_CANDIDATES (sizeof(tile_row_candidates) / sizeof(tile_row_candidates[0]))
+
+void tune_file_name(char* name, int length)
+{
+    char host[MPI_MAX_PROCESSOR_NAME];
+    int host_length;
+
+    MPI_Get_processor_name(host, &host_length);
+    snprintf(name, length, "mpi_test-%s.tune", host);
+}
+
+int load_tuning(Tuning* tuning, const char* file_name)
+{
+    FILE* file = fopen(file_name, "r");
+    if (file == NULL) {
+        return -1;
+    }
+
+    char variant[32];
+    int found = fscanf(file, "tile_rows=%u\nthreads=%u\nvariant=%31s\n", &tuning->tile_rows, &tuning->threads, variant);
+    fclose(file);
+
+    KernelVariant kernel_variant;
+    if (found != 3 || tuning->tile_rows == 0 || tuning->threads == 0 || parse_kernel_variant(variant, &kernel_variant) != 0) {
+        return -1;
+    }
+
+    tuning->variant = kernel_variant;
+    return 0;
+}
+
+int save_tuning(const Tuning* tuning, const char* file_name)
+{
+    FILE* file = fopen(file_name, "w");
+    if (file == NULL) {
+        perror(file_name);
+        return -1;
+    }
+
+    fprintf(file, "tile_rows=%u\nthreads=%u\nvariant=%s\n", tuning->tile_rows, tuning->threads, kernel_variant_name(tuning->variant));
+    fclose(file);
+    return 0;
+}
+
+void make_calibration_work(WorkUnit* sample, Rect view, Bound img, const Kernel* kernel)
+{
+    Bound size;
+    int width = img.width / CALIBRATION_FACTOR, height = img.height / CALIBRATION_FACTOR;
+
+    make_bound(&size,
+        width < 1 ? 1 : (width > CALIBRATION_MAX_WIDTH ? CALIBRATION_MAX_WIDTH : width),
+        height < 1 ? 1 : (height > CALIBRATION_MAX_HEIGHT ? CALIBRATION_MAX_HEIGHT : height));
+
+    memset(sample, 0, sizeof(WorkUnit));
+    make_band(sample, view, size, 0, size.height);
+    sample->kernel = *kernel;
+}
+
+// slowest rank's time, since every band waits for it
+static double time_candidate(const WorkUnit* sample, uint32_t* iterations, const Tuning* candidate, MPI_Comm comm)
+{
+    double start = MPI_Wtime();
+    render_work(sample, iterations, candidate, NULL);
+    double elapsed = MPI_Wtime() - start;
+
+    MPI_Allreduce(MPI_IN_PLACE, &elapsed, 1, MPI_DOUBLE, MPI_MAX, comm);
+    return elapsed;
+}
+
+static int max_threads(MPI_Comm comm)
+{
+#ifdef _OPENMP
+    MPI_Comm node;
+    int local_ranks;
+
+    // cores are shared by every rank on the node
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    MPI_Comm_size(node, &local_ranks);
+    MPI_Comm_free(&node);
+
+    int threads = omp_get_num_procs() / local_ranks;
+    MPI_Allreduce(MPI_IN_PLACE, &threads, 1, MPI_INT, MPI_MIN, comm);
+    return threads > 0 ? threads : 1;
+#else
+    return 1;
+#endif
+}
+
+/*
+ * Collective over comm, the ranks of one host: times the sample on every
+ * rank and settles one dimension at a time (kernel variant, then threads,
+ * then tile height) instead of the full cross product, which keeps
+ * calibration to a handful of renders.
+ */
+void calibrate(Tuning* tuning, const WorkUnit* sample, MPI_Comm comm)
+{
+    uint32_t* iterations = malloc(bound_length(sample->bound) * sizeof(uint32_t));
+    int threads = max_threads(comm);
+    double best;
+
+    default_tuning(tuning);
+    tuning->threads = threads;
+
+    // warm up caches and page in the buffer before anything is timed
+    time_candidate(sample, iterations, tuning, comm);
+
+    best = -1.0;
+    for (int variant = 0; variant < KERNEL_VARIANTS; variant++) {
+        Tuning candidate = *tuning;
+        candidate.variant = variant;
+
+        double elapsed = time_candidate(sample, iterations, &candidate, comm);
+        if (best < 0.0 || elapsed < best) {
+            best = elapsed;
+            tuning->variant = variant;
+        }
+    }
+
+    // powers of two, then every core this rank may use
+    for (int count = 1; count <= threads; count = count < threads && count * 2 > threads ? threads : count * 2) {
+        Tuning candidate = *tuning;
+        candidate.threads = count;
+
+        double elapsed = time_candidate(sample, iterations, &candidate, comm);
+        if (elapsed < best) {
+            best = elapsed;
+            tuning->threads = count;
+        }
+    }
+
+    for (size_t i = 0; i < TILE_ROW_CANDIDATES; i++) {
+        Tuning candidate = *tuning;
+        candidate.tile_rows = tile_row_candidates[i];
+
+        double elapsed = time_candidate(sample, iterations, &candidate, comm);
+        if (elapsed < best) {
+            best = elapsed;
+            tuning->tile_rows = candidate.tile_rows;
+        }
+    }
+
+    free(iterations);
+}
+
+/*
+ * Collective: every host ends up with its own Tuning, shared by its ranks.
+ * With autotune set the sample is calibrated on each host, by that host's
+ * ranks alone, and saved to its tuning file; otherwise each host loads its
+ * file, or the defaults when it has none. The settings only decide how a
+ * rank renders its own band, so they may differ between hosts. Non-zero
+ * fields of root's requested settings override them everywhere.
+ */
+void establish_tuning(Tuning* tuning, WorkUnit* sample, const Tuning* requested, int autotune, MPI_Datatype workunit_type, MPI_Comm comm)
+{
+    int rank, ranks;
+    uint32_t settings[4] = { 0, 0, 0, 0 };
+    char file_name[MPI_MAX_PROCESSOR_NAME + 32];
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+    if (rank == 0) {
+        settings[0] = requested->tile_rows;
+        settings[1] = requested->threads;
+        settings[2] = requested->variant;
+        settings[3] = autotune;
+    }
+
+    MPI_Bcast(settings, 4, MPI_UINT32_T, 0, comm);
+    MPI_Bcast(sample, 1, workunit_type, 0, comm);
+    tune_file_name(file_name, sizeof(file_name));
+
+    MPI_Comm node;
+    int local_rank;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &local_rank);
+
+    if (settings[3]) {
+        double start = MPI_Wtime();
+        calibrate(tuning, sample, node);
+
+        if (local_rank == 0) {
+            save_tuning(tuning, file_name);
+        }
+
+        MPI_Barrier(comm);
+        if (rank == 0) {
+            printf("Calibration took %.3fs\n", MPI_Wtime() - start);
+        }
+    } else if (load_tuning(tuning, file_name) != 0) {
+        default_tuning(tuning);
+    }
+
+    MPI_Comm_free(&node);
+
+    if (settings[0] > 0) {
+        tuning->tile_rows = settings[0];
+    }
+    if (settings[1] > 0) {
+        tuning->threads = settings[1];
+    }
+    if (settings[2] < KERNEL_VARIANTS) {
+        tuning->variant = settings[2];
+    }
+
+    // root prints its own tuning and every rank that differs from it
+    uint32_t values[3] = { tuning->tile_rows, tuning->threads, tuning->variant };
+    uint32_t* all = rank == 0 ? malloc(3 * ranks * sizeof(uint32_t)) : NULL;
+    MPI_Gather(values, 3, MPI_UINT32_T, all, 3, MPI_UINT32_T, 0, comm);
+
+    for (int r = 0; rank == 0 && r < ranks; r++) {
+        const uint32_t* other = all + 3 * r;
+        if (r == 0) {
+            printf("Tuning: %u rows per tile, %u threads per rank, %s kernel\n", other[0], other[1], kernel_variant_name(other[2]));
+        } else if (memcmp(other, all, 3 * sizeof(uint32_t)) != 0) {
+            printf("Tuning of rank %d: %u rows per tile, %u threads, %s kernel\n", r, other[0], other[1], kernel_variant_name(other[2]));
+        }
+    }
+    free(all);
+}
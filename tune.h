@@ -0,0 +1,21 @@
+#ifndef _TUNE_H_
+#define _TUNE_H_
+
+#include "kernels.h"
+#include "mpi_test.h"
+
+// Calibration renders the view at 1/CALIBRATION_FACTOR of the image size in
+// each direction, capped to CALIBRATION_MAX_WIDTH x CALIBRATION_MAX_HEIGHT
+#define CALIBRATION_FACTOR 8
+#define CALIBRATION_MAX_WIDTH 256
+#define CALIBRATION_MAX_HEIGHT 192
+
+void tune_file_name(char* name, int length);
+int load_tuning(Tuning* tuning, const char* file_name);
+int save_tuning(const Tuning* tuning, const char* file_name);
+
+void make_calibration_work(WorkUnit* sample, Rect view, Bound img, const Kernel* kernel);
+void calibrate(Tuning* tuning, const WorkUnit* sample, MPI_Comm comm);
+void establish_tuning(Tuning* tuning, WorkUnit* sample, const Tuning* requested, int autotune, MPI_Datatype workunit_type, MPI_Comm comm);
+
+#endif
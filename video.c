@@ -0,0 +1,271 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "image_io.h"
+#include "video.h"
+
+// stdout as it was before claim_stdout_stream() moved the diagnostics off it
+static int stdout_stream = -1;
+
+static int names_stdout(const char* option, const char* value)
+{
+    if (strcmp(option, "-o-") == 0 || strcmp(option, "--output=-") == 0) {
+        return 1;
+    }
+
+    return value != NULL && strcmp(value, "-") == 0 && (strcmp(option, "-o") == 0 || strcmp(option, "--output") == 0);
+}
+
+/*
+ * An output of "-" streams the video to stdout, which every rank also prints
+ * its diagnostics to and mpirun forwards to the same place. Before anything
+ * is printed, every rank checks its arguments for it and, if found, keeps
+ * stdout for the stream and sends its own output to stderr instead.
+ */
+void claim_stdout_stream(int argc, const char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (names_stdout(argv[i], i + 1 < argc ? argv[i + 1] : NULL)) {
+            fflush(stdout);
+            stdout_stream = dup(STDOUT_FILENO);
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+            return;
+        }
+    }
+}
+
+size_t chroma_width(Bound size)
+{
+    return (size.width + 1) / 2;
+}
+
+size_t chroma_rows(uint32_t rows)
+{
+    return (rows + 1) / 2;
+}
+
+// a band starts on an even row, so its chroma rows are its own
+size_t yuv_band_size(Bound band)
+{
+    return (size_t)band.width * band.height + 2 * chroma_width(band) * chroma_rows(band.height);
+}
+
+static uint8_t chroma(int32_t sum)
+{
+    // sum is 256 times a 2x2 block's total, the mean is 1024 times smaller
+    int32_t value = (sum + (128 << 10) + 512) >> 10;
+    return value > 255 ? 255 : value;
+}
+
+/*
+ * Converts a band of RGB pixels starting on an even image row to planar
+ * 4:2:0 YCbCr with full range BT.601 coefficients, as C420jpeg asks for.
+ * Chroma is the mean of each 2x2 block, the last row or column of an odd
+ * sized band pairing with itself. Every inner loop is straight fixed point
+ * arithmetic for the compiler to vectorize; pixels are read with a stride
+ * of three bytes, which takes byte shuffles (SSSE3 or NEON) to vectorize.
+ * Chroma is linear, so each column pair's Cb and Cr are summed over both
+ * rows first, into a row of int32 sums, and then over the pair.
+ */
+void rgb_to_yuv420(const Pixel* pixels, Bound band, uint8_t* y, uint8_t* u, uint8_t* v)
+{
+    int width = band.width;
+    int chroma_stride = chroma_width(band);
+    int32_t* sums = malloc(2 * ((size_t)width + 1) * sizeof(int32_t));
+    int32_t* cb_sum = sums;
+    int32_t* cr_sum = sums + width + 1;
+
+    for (int row = 0; row < (int)band.height; row++) {
+        const Pixel* p = pixels + (size_t)row * width;
+        uint8_t* luma = y + (size_t)row * width;
+
+#pragma omp simd
+        for (int x = 0; x < width; x++) {
+            luma[x] = (77 * p[x].red + 150 * p[x].green + 29 * p[x].blue + 128) >> 8;
+        }
+    }
+
+    for (int row = 0; row < (int)chroma_rows(band.height); row++) {
+        const Pixel* top = pixels + (size_t)2 * row * width;
+        const Pixel* bottom = 2 * row + 1 < (int)band.height ? top + width : top;
+        uint8_t* cb = u + (size_t)row * chroma_stride;
+        uint8_t* cr = v + (size_t)row * chroma_stride;
+
+#pragma omp simd
+        for (int x = 0; x < width; x++) {
+            int red = top[x].red + bottom[x].red;
+            int green = top[x].green + bottom[x].green;
+            int blue = top[x].blue + bottom[x].blue;
+
+            cb_sum[x] = -43 * red - 85 * green + 128 * blue;
+            cr_sum[x] = 128 * red - 107 * green - 21 * blue;
+        }
+
+        // an odd last column pairs with itself
+        cb_sum[width] = cb_sum[width - 1];
+        cr_sum[width] = cr_sum[width - 1];
+
+#pragma omp simd
+        for (int x = 0; x < chroma_stride; x++) {
+            cb[x] = chroma(cb_sum[2 * x] + cb_sum[2 * x + 1]);
+            cr[x] = chroma(cr_sum[2 * x] + cr_sum[2 * x + 1]);
+        }
+    }
+
+    free(sums);
+}
+
+static int write_all(int fd, const void* data, size_t length)
+{
+    const uint8_t* bytes = data;
+
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        bytes += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+// frames leave in the order they were queued; once the reader has gone the rest are dropped
+static void* write_frames(void* arg)
+{
+    VideoStream* video = arg;
+
+    pthread_mutex_lock(&video->lock);
+    for (;;) {
+        while (video->queued == 0 && !video->closing) {
+            pthread_cond_wait(&video->ready, &video->lock);
+        }
+        if (video->queued == 0) {
+            break;
+        }
+
+        const uint8_t* frame = video->slots[video->head];
+        int failed = video->failed;
+        pthread_mutex_unlock(&video->lock);
+
+        if (!failed && (write_all(video->fd, "FRAME\n", 6) != 0 || write_all(video->fd, frame, video->frame_length) != 0)) {
+            perror("Video stream");
+            failed = 1;
+        }
+
+        pthread_mutex_lock(&video->lock);
+        video->failed = failed;
+        video->written += !failed;
+        video->head = (video->head + 1) % VIDEO_QUEUE_FRAMES;
+        video->queued--;
+        pthread_cond_signal(&video->space);
+    }
+    pthread_mutex_unlock(&video->lock);
+
+    return NULL;
+}
+
+/*
+ * Opens file_name, "-" for stdout, and writes the stream header. Opening a
+ * FIFO waits here until its reader has opened the other end.
+ */
+int video_open(VideoStream* video, const char* file_name, Bound size, int fps)
+{
+    memset(video, 0, sizeof(*video));
+
+    if (strcmp(file_name, "-") == 0) {
+        video->fd = stdout_stream >= 0 ? stdout_stream : dup(STDOUT_FILENO);
+    } else {
+        video->fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    if (video->fd < 0) {
+        perror(file_name);
+        return -1;
+    }
+
+    // a reader that quits early fails the writes instead of killing the process
+    signal(SIGPIPE, SIG_IGN);
+
+    char header[IMAGE_HEADER_MAX];
+    int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%d:1 Ip A1:1 C420jpeg\n", size.width, size.height, fps);
+    if (write_all(video->fd, header, length) != 0) {
+        perror(file_name);
+        close(video->fd);
+        return -1;
+    }
+
+    video->size = size;
+    video->frame_length = yuv_band_size(size);
+    for (int i = 0; i < VIDEO_QUEUE_FRAMES; i++) {
+        video->slots[i] = malloc(video->frame_length);
+    }
+
+    pthread_mutex_init(&video->lock, NULL);
+    pthread_cond_init(&video->ready, NULL);
+    pthread_cond_init(&video->space, NULL);
+    if (pthread_create(&video->writer, NULL, write_frames, video) != 0) {
+        printf("Unable to start the video writer thread\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// the next free frame buffer, waiting for the writer if the queue is full
+uint8_t* video_next_frame(VideoStream* video)
+{
+    double start = MPI_Wtime();
+
+    pthread_mutex_lock(&video->lock);
+    while (video->queued == VIDEO_QUEUE_FRAMES) {
+        pthread_cond_wait(&video->space, &video->lock);
+    }
+    uint8_t* frame = video->slots[(video->head + video->queued) % VIDEO_QUEUE_FRAMES];
+    pthread_mutex_unlock(&video->lock);
+
+    video->waited += MPI_Wtime() - start;
+    return frame;
+}
+
+void video_queue_frame(VideoStream* video)
+{
+    pthread_mutex_lock(&video->lock);
+    video->queued++;
+    pthread_cond_signal(&video->ready);
+    pthread_mutex_unlock(&video->lock);
+}
+
+// waits for the queued frames to be written, then closes the stream
+int video_close(VideoStream* video)
+{
+    pthread_mutex_lock(&video->lock);
+    video->closing = 1;
+    pthread_cond_signal(&video->ready);
+    pthread_mutex_unlock(&video->lock);
+
+    pthread_join(video->writer, NULL);
+    close(video->fd);
+
+    printf("Video stream: %llu frames written, %.3fs waiting for the reader%s\n", (unsigned long long)video->written,
+        video->waited, video->failed ? ", reader closed the stream early" : "");
+
+    for (int i = 0; i < VIDEO_QUEUE_FRAMES; i++) {
+        free(video->slots[i]);
+    }
+    pthread_cond_destroy(&video->space);
+    pthread_cond_destroy(&video->ready);
+    pthread_mutex_destroy(&video->lock);
+
+    return video->failed ? -1 : 0;
+}
@@ -0,0 +1,45 @@
+#ifndef _VIDEO_H_
+#define _VIDEO_H_
+
+#include <pthread.h>
+
+#include "mpi_test.h"
+
+// Frames converted and waiting for the writer; a slow reader holds root up
+// once they are all in use
+#define VIDEO_QUEUE_FRAMES 3
+#define VIDEO_DEFAULT_FPS 25
+
+// A YUV4MPEG2 stream of 4:2:0 frames, written in order by its own thread so
+// root can go on with the next frame while the reader catches up. Only
+// root opens one.
+typedef struct VideoStream {
+    int fd;
+    Bound size;
+    size_t frame_length;
+    uint8_t* slots[VIDEO_QUEUE_FRAMES];
+    int head; // next slot to write
+    int queued;
+    int closing;
+    int failed;
+    uint64_t written;
+    double waited; // root's time blocked on a full queue
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+    pthread_t writer;
+} VideoStream;
+
+void claim_stdout_stream(int argc, const char** argv);
+
+int video_open(VideoStream* video, const char* file_name, Bound size, int fps);
+uint8_t* video_next_frame(VideoStream* video);
+void video_queue_frame(VideoStream* video);
+int video_close(VideoStream* video);
+
+size_t chroma_width(Bound size);
+size_t chroma_rows(uint32_t rows);
+size_t yuv_band_size(Bound band);
+void rgb_to_yuv420(const Pixel* pixels, Bound band, uint8_t* y, uint8_t* u, uint8_t* v);
+
+#endif
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image_io.h"
+#include "writer.h"
+
+// Collective: the communicator of the compute ranks, MPI_COMM_NULL on the writers
+MPI_Comm split_writers(int writers, MPI_Comm world)
+{
+    int rank, ranks;
+    MPI_Comm compute;
+
+    MPI_Comm_rank(world, &rank);
+    MPI_Comm_size(world, &ranks);
+    MPI_Comm_split(world, rank < ranks - writers ? 0 : MPI_UNDEFINED, rank, &compute);
+
+    return compute;
+}
+
+static int writer_of(const WriterLink* link, uint32_t frame)
+{
+    return link->compute_ranks + frame % link->writers;
+}
+
+void writer_link_init(WriterLink* link, int writers, MPI_Comm world)
+{
+    int ranks;
+    MPI_Comm_size(world, &ranks);
+
+    link->world = world;
+    link->writers = writers;
+    link->compute_ranks = ranks - writers;
+    for (int i = 0; i < WRITER_BUFFERS; i++) {
+        link->bands[i] = NULL;
+        link->capacity[i] = 0;
+        link->requests[i] = MPI_REQUEST_NULL;
+    }
+}
+
+// The buffer to colour this frame's band into, once the band sent from it
+// WRITER_BUFFERS frames ago has left. Called after the band is rendered, so
+// the render never waits on a writer.
+Pixel* writer_band(WriterLink* link, uint32_t frame, size_t pixels)
+{
+    int slot = frame % WRITER_BUFFERS;
+
+    MPI_Wait(&link->requests[slot], MPI_STATUS_IGNORE);
+
+    if (pixels > link->capacity[slot]) {
+        free(link->bands[slot]);
+        link->bands[slot] = malloc(pixels * sizeof(Pixel));
+        link->capacity[slot] = pixels;
+    }
+
+    return link->bands[slot];
+}
+
+// root tells the frame's writer where every compute rank's band goes and what precision it was rendered in
+void send_frame_header(WriterLink* link, uint32_t frame, const char* file_name, const char* precision, Bound img, const WorkUnit* bands)
+{
+    int* layout = malloc((2 + 2 * link->compute_ranks) * sizeof(int));
+
+    layout[0] = img.width;
+    layout[1] = img.height;
+    for (int r = 0; r < link->compute_ranks; r++) {
+        layout[2 + r] = bound_length(bands[r].bound);
+        layout[2 + link->compute_ranks + r] = bands[r].row_offset * img.width;
+    }
+
+    MPI_Send(file_name, OUTPUT_NAME_MAX, MPI_CHAR, writer_of(link, frame), WRITER_HEADER_TAG, link->world);
+    MPI_Send(precision, PRECISION_TEXT_MAX, MPI_CHAR, writer_of(link, frame), WRITER_HEADER_TAG, link->world);
+    MPI_Send(layout, 2 + 2 * link->compute_ranks, MPI_INT, writer_of(link, frame), WRITER_HEADER_TAG, link->world);
+    free(layout);
+}
+
+void send_band(WriterLink* link, uint32_t frame, const WorkUnit* work, MPI_Datatype pixel_type)
+{
+    int slot = frame % WRITER_BUFFERS;
+
+    MPI_Isend(link->bands[slot], bound_length(work->bound), pixel_type, writer_of(link, frame), WRITER_BAND_TAG, link->world, &link->requests[slot]);
+}
+
+// finishes the last sends; root then tells every writer there are no more frames
+void writer_link_close(WriterLink* link, int root)
+{
+    char done[OUTPUT_NAME_MAX] = "";
+
+    MPI_Waitall(WRITER_BUFFERS, link->requests, MPI_STATUSES_IGNORE);
+    for (int i = 0; i < WRITER_BUFFERS; i++) {
+        free(link->bands[i]);
+    }
+
+    for (int w = 0; root && w < link->writers; w++) {
+        MPI_Send(done, OUTPUT_NAME_MAX, MPI_CHAR, link->compute_ranks + w, WRITER_HEADER_TAG, link->world);
+    }
+}
+
+/*
+ * The loop of a writer rank. For each of its frames, root sends the file
+ * name, precision description and band layout, and every compute rank sends
+ * its coloured band straight into place in the image. The writer then
+ * encodes and writes the image with write_image(), keeping the precision as
+ * a PNG text chunk, while the compute ranks render the next frames.
+ * An empty file name ends the loop.
+ */
+void serve_writes(const Local_MPI_Types* types, int writers, MPI_Comm world)
+{
+    int rank, ranks;
+    MPI_Comm_rank(world, &rank);
+    MPI_Comm_size(world, &ranks);
+
+    int compute_ranks = ranks - writers;
+    char file_name[OUTPUT_NAME_MAX];
+    char precision[PRECISION_TEXT_MAX];
+    int* layout = malloc((2 + 2 * compute_ranks) * sizeof(int));
+    MPI_Request* requests = malloc(compute_ranks * sizeof(MPI_Request));
+    Pixel* image = NULL;
+    size_t capacity = 0;
+    uint32_t written = 0;
+    double busy = 0.0;
+
+    for (;;) {
+        MPI_Recv(file_name, OUTPUT_NAME_MAX, MPI_CHAR, 0, WRITER_HEADER_TAG, world, MPI_STATUS_IGNORE);
+        if (file_name[0] == '\0') {
+            break;
+        }
+        MPI_Recv(precision, PRECISION_TEXT_MAX, MPI_CHAR, 0, WRITER_HEADER_TAG, world, MPI_STATUS_IGNORE);
+        MPI_Recv(layout, 2 + 2 * compute_ranks, MPI_INT, 0, WRITER_HEADER_TAG, world, MPI_STATUS_IGNORE);
+
+        Bound size = { layout[0], layout[1] };
+        if (bound_length(size) > capacity) {
+            free(image);
+            capacity = bound_length(size);
+            image = malloc(capacity * sizeof(Pixel));
+        }
+
+        for (int r = 0; r < compute_ranks; r++) {
+            MPI_Irecv(image + layout[2 + compute_ranks + r], layout[2 + r], types->pixel_type, r, WRITER_BAND_TAG, world, &requests[r]);
+        }
+        MPI_Waitall(compute_ranks, requests, MPI_STATUSES_IGNORE);
+
+        double start = MPI_Wtime();
+        int status = write_image(image, size, file_name, "Precision", precision);
+        double elapsed = MPI_Wtime() - start;
+
+        busy += elapsed;
+        written++;
+        printf("Writer %d: %s %s in %.3fs\n", rank, status == 0 ? "wrote" : "failed to write", file_name, elapsed);
+    }
+
+    printf("Writer %d: %u frames, %.3fs writing\n", rank, written, busy);
+
+    free(image);
+    free(layout);
+    free(requests);
+}
@@ -0,0 +1,42 @@
+#ifndef _WRITER_H_
+#define _WRITER_H_
+
+#include <mpi.h>
+
+#include "mpi_test.h"
+
+#define WRITER_HEADER_TAG 4
+#define WRITER_BAND_TAG 5
+
+// Band buffers a compute rank cycles through, so a frame's band can still be
+// on its way to the writer while the next frame is coloured
+#define WRITER_BUFFERS 2
+
+// Longest description of a frame's precision, sent with its header
+#define PRECISION_TEXT_MAX 128
+
+// The compute side of the writer ranks, which are the last ranks of the
+// world communicator. Frame f is written by writer f % writers. A compute
+// rank colours frame f's band into bands[f % WRITER_BUFFERS] and sends it
+// without waiting; the send is only completed when that buffer is coloured
+// into again, WRITER_BUFFERS frames later.
+typedef struct WriterLink {
+    MPI_Comm world;
+    int writers;
+    int compute_ranks;
+    Pixel* bands[WRITER_BUFFERS];
+    size_t capacity[WRITER_BUFFERS];
+    MPI_Request requests[WRITER_BUFFERS];
+} WriterLink;
+
+MPI_Comm split_writers(int writers, MPI_Comm world);
+
+void writer_link_init(WriterLink* link, int writers, MPI_Comm world);
+Pixel* writer_band(WriterLink* link, uint32_t frame, size_t pixels);
+void send_frame_header(WriterLink* link, uint32_t frame, const char* file_name, const char* precision, Bound img, const WorkUnit* bands);
+void send_band(WriterLink* link, uint32_t frame, const WorkUnit* work, MPI_Datatype pixel_type);
+void writer_link_close(WriterLink* link, int root);
+
+void serve_writes(const Local_MPI_Types* types, int writers, MPI_Comm world);
+
+#endif
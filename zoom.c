@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "partition.h"
+#include "zoom.h"
+
+static double snap_step(double step)
+{
+    int exponent;
+    double mantissa = frexp(step, &exponent);
+
+    return ldexp(nearbyint(ldexp(mantissa, ZOOM_STEP_BITS)), exponent - ZOOM_STEP_BITS);
+}
+
+/*
+ * Frame index of a zoom about center, each frame half the size of the one
+ * before. The steps are rounded to ZOOM_STEP_BITS and halved exactly, and
+ * the corner is a whole number of steps from zero, so origin + step * x is
+ * computed without rounding in every frame and a pixel of one frame lands
+ * bit for bit on every other pixel of the next.
+ */
+void zoom_frame(ZoomFrame* frame, Point center, RectSize size, Bound img, uint32_t index)
+{
+    double dx = ldexp(snap_step(size.width / img.width), -(int)index);
+    double dy = ldexp(snap_step(size.height / img.height), -(int)index);
+
+    frame->kx = llround(center.x / dx - img.width / 2.0);
+    frame->ky = llround(center.y / dy + img.height / 2.0);
+
+    frame->view.ul.x = dx * frame->kx;
+    frame->view.ul.y = dy * frame->ky;
+    frame->view.lr.x = dx * (frame->kx + img.width);
+    frame->view.lr.y = dy * (frame->ky - img.height);
+}
+
+// true when every pixel of an axis with shift + pixel even halves onto one of length pixels
+static int reusable_axis(int64_t shift, uint32_t length)
+{
+    int64_t first = shift & 1;
+    int64_t last = length - 1 - ((length - 1 + shift) & 1);
+
+    return shift > INT32_MIN && shift < INT32_MAX && last >= first
+        && (first + shift) / 2 >= 0 && (last + shift) / 2 < length;
+}
+
+static int exact_frame(const ZoomFrame* frame, Bound img)
+{
+    return llabs(frame->kx) + img.width < ZOOM_MAX_OFFSET && llabs(frame->ky) + img.height < ZOOM_MAX_OFFSET;
+}
+
+/*
+ * Sets the reuse fields of work for a frame zoomed 2x in from previous.
+ * Returns zero, leaving reuse off, when the steps are not exactly halved,
+ * either frame is too deep for exact pixel positions or the shared samples
+ * fall outside the previous frame.
+ */
+int zoom_reuse(WorkUnit* work, const ZoomFrame* previous, const ZoomFrame* next, Bound img)
+{
+    int64_t shift_x = next->kx - 2 * previous->kx;
+    int64_t shift_y = 2 * previous->ky - next->ky;
+
+    work->reuse = 0;
+    work->reuse_x = 0;
+    work->reuse_y = 0;
+
+    if (rect_width(previous->view) != 2.0 * rect_width(next->view)
+        || rect_height(previous->view) != 2.0 * rect_height(next->view)
+        || !exact_frame(previous, img) || !exact_frame(next, img)
+        || !reusable_axis(shift_x, img.width) || !reusable_axis(shift_y, img.height)) {
+        return 0;
+    }
+
+    work->reuse = 1;
+    work->reuse_x = shift_x;
+    work->reuse_y = shift_y;
+    return 1;
+}
+
+void frame_history_init(FrameHistory* history)
+{
+    history->iterations = NULL;
+    history->capacity = 0;
+    history->first_row = 0;
+}
+
+void frame_history_keep(FrameHistory* history, const WorkUnit* work, const uint32_t* iterations)
+{
+    size_t length = bound_length(work->bound);
+
+    if (length > history->capacity) {
+        free(history->iterations);
+        history->iterations = malloc(length * sizeof(uint32_t));
+        history->capacity = length;
+    }
+
+    memcpy(history->iterations, iterations, length * sizeof(uint32_t));
+    history->first_row = work->row_offset;
+}
+
+void frame_history_free(FrameHistory* history)
+{
+    free(history->iterations);
+    frame_history_init(history);
+}
+
+/*
+ * Collective: copies the counts of every reused pixel of the band from the
+ * rank whose previous band holds them. The reused pixels of a row sit on
+ * every other column and come from one contiguous run of a previous row, so
+ * both sides work out the same runs from the two band layouts and only the
+ * counts travel. Mirrored rows are left to fill_mirrored_rows().
+ */
+void fill_reused_pixels(const WorkUnit* work, uint32_t* iterations, const FrameHistory* history, MPI_Comm comm)
+{
+    if (!work->reuse) {
+        return;
+    }
+
+    int rank, ranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    uint32_t first_row = work->row_offset;
+    uint32_t end_row = first_row + work->bound.height;
+    uint32_t* first_rows = malloc(ranks * sizeof(uint32_t));
+    uint32_t* end_rows = malloc(ranks * sizeof(uint32_t));
+    uint32_t* previous_rows = malloc(ranks * sizeof(uint32_t));
+    MPI_Allgather(&first_row, 1, MPI_UINT32_T, first_rows, 1, MPI_UINT32_T, comm);
+    MPI_Allgather(&end_row, 1, MPI_UINT32_T, end_rows, 1, MPI_UINT32_T, comm);
+    MPI_Allgather(&history->first_row, 1, MPI_UINT32_T, previous_rows, 1, MPI_UINT32_T, comm);
+
+    int width = work->bound.width;
+    int x_first = work->reuse_x & 1;
+    int source_x = (x_first + work->reuse_x) / 2;
+    int run = (width - x_first + 1) / 2;
+
+    int* send_counts = calloc(ranks, sizeof(int));
+    int* send_displs = calloc(ranks, sizeof(int));
+    int* recv_counts = calloc(ranks, sizeof(int));
+    int* recv_displs = calloc(ranks, sizeof(int));
+
+    for (int r = 0; r < ranks; r++) {
+        for (uint32_t row = first_rows[r]; row < end_rows[r]; row++) {
+            if (!reuse_row(work, row) || mirror_row(work, row) >= 0) {
+                continue;
+            }
+
+            int owner = band_of_row(previous_rows, ranks, ((int)row + work->reuse_y) / 2);
+            if (r == rank) {
+                recv_counts[owner] += run;
+            }
+            if (owner == rank) {
+                send_counts[r] += run;
+            }
+        }
+    }
+
+    for (int r = 1; r < ranks; r++) {
+        send_displs[r] = send_displs[r - 1] + send_counts[r - 1];
+        recv_displs[r] = recv_displs[r - 1] + recv_counts[r - 1];
+    }
+
+    uint32_t* send = malloc(((size_t)send_displs[ranks - 1] + send_counts[ranks - 1] + 1) * sizeof(uint32_t));
+    uint32_t* recv = malloc(((size_t)recv_displs[ranks - 1] + recv_counts[ranks - 1] + 1) * sizeof(uint32_t));
+
+    // runs go out in the order of the destination band, one run per row
+    uint32_t* cursor = send;
+    for (int r = 0; r < ranks; r++) {
+        for (uint32_t row = first_rows[r]; row < end_rows[r]; row++) {
+            if (!reuse_row(work, row) || mirror_row(work, row) >= 0) {
+                continue;
+            }
+
+            int source = ((int)row + work->reuse_y) / 2;
+            if (band_of_row(previous_rows, ranks, source) == rank) {
+                memcpy(cursor, history->iterations + (size_t)(source - history->first_row) * width + source_x, run * sizeof(uint32_t));
+                cursor += run;
+            }
+        }
+    }
+
+    MPI_Alltoallv(send, send_counts, send_displs, MPI_UINT32_T, recv, recv_counts, recv_displs, MPI_UINT32_T, comm);
+
+    for (int r = 0; r < ranks; r++) {
+        const uint32_t* run_data = recv + recv_displs[r];
+        for (uint32_t row = first_row; row < end_row; row++) {
+            if (!reuse_row(work, row) || mirror_row(work, row) >= 0
+                || band_of_row(previous_rows, ranks, ((int)row + work->reuse_y) / 2) != r) {
+                continue;
+            }
+
+            uint32_t* dest = iterations + (size_t)(row - first_row) * width + x_first;
+            for (int i = 0; i < run; i++) {
+                dest[2 * i] = run_data[i];
+            }
+            run_data += run;
+        }
+    }
+
+    free(send);
+    free(recv);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+    free(first_rows);
+    free(end_rows);
+    free(previous_rows);
+}
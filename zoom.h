@@ -0,0 +1,39 @@
+#ifndef _ZOOM_H_
+#define _ZOOM_H_
+
+#include "mpi_test.h"
+
+// Significant bits kept in the pixel step of a zoom frame. Every pixel of a
+// frame is then an exact multiple of the step, and halving the step from one
+// frame to the next keeps the previous frame's samples on the new grid.
+#define ZOOM_STEP_BITS 8
+
+// Pixel offsets from zero must stay below this for step * offset to be exact
+#define ZOOM_MAX_OFFSET (1LL << (53 - ZOOM_STEP_BITS))
+
+// Frame index of a 2x zoom sequence: the view's upper left corner is
+// (kx, ky) pixel steps from zero.
+typedef struct ZoomFrame {
+    Rect view;
+    int64_t kx;
+    int64_t ky;
+} ZoomFrame;
+
+// The previous frame's iteration counts of this rank's band, kept across
+// frames so the next one can take the samples it shares
+typedef struct FrameHistory {
+    uint32_t* iterations;
+    size_t capacity;
+    uint32_t first_row;
+} FrameHistory;
+
+void zoom_frame(ZoomFrame* frame, Point center, RectSize size, Bound img, uint32_t index);
+int zoom_reuse(WorkUnit* work, const ZoomFrame* previous, const ZoomFrame* next, Bound img);
+
+void frame_history_init(FrameHistory* history);
+void frame_history_keep(FrameHistory* history, const WorkUnit* work, const uint32_t* iterations);
+void frame_history_free(FrameHistory* history);
+
+void fill_reused_pixels(const WorkUnit* work, uint32_t* iterations, const FrameHistory* history, MPI_Comm comm);
+
+#endif